@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file adcCalibration.h
+* @brief ADC offset calibration, measured once and cached in the reserved
+* last flash page so later boots only reload the factor.
+* @version 1.0
+* @date 2026-10-17
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#ifndef ADCCALIBRATION_H_
+#define ADCCALIBRATION_H_
+
+#include <stdint.h>
+
+// Interval after which maintain_adc_calibration measures the factor again, 0 never
+#define DEFAULT_RECALIBRATION_INTERVAL_MS (10UL * 60UL * 1000UL)
+
+typedef enum {
+	ADC_CALIBRATION_NONE,	// not calibrated yet
+	ADC_CALIBRATION_RESTORED,	// factor reloaded from flash
+	ADC_CALIBRATION_MEASURED,	// factor measured by the ADC since boot
+} AdcCalibrationSource;
+
+// Reloads the cached factor or calibrates once and caches the result, call after MX_ADC1_Init
+int init_adc_calibration(void * adc, void * uart, unsigned long recalibration_interval_ms);
+
+// Measures the factor now and caches it if it changed, the ADC must not be converting
+int calibrate_adc(void * adc);
+
+// Calibrates again once the recalibration interval elapsed, call between captures
+int maintain_adc_calibration(void * adc);
+
+void set_adc_recalibration_interval(unsigned long interval_ms);
+
+uint32_t get_adc_calibration_factor(void);
+
+AdcCalibrationSource get_adc_calibration_source(void);
+
+#endif /* ADCCALIBRATION_H_ */
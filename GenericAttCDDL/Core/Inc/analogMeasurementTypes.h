@@ -151,6 +151,9 @@ struct interval_frequency_duration_r {
 };
 
 #define values_map 0//required for RegularMeasurementSeries
+#define typed_values_map 4//replaces values_map for a typed array of raw samples
+#define delta_values_map 5//replaces values_map for zigzag varint deltas of raw samples
+#define TYPED_ARRAY_UINT16_LE_TAG 69//RFC 8746 uint16 little endian typed array
 
 struct RegularMeasurementSeries {
 	struct NumericalValue_value_r RegularMeasurementSeries_values_NumericalValue_m[DEFAULT_MAX_QTY];
@@ -194,6 +197,7 @@ struct Target {
 	UsefulBufC Target_id;
 	struct Params Target_config_params;
 	bool Target_config_params_present;
+	UsefulBufC Target_encoded;//the whole Target encoded beforehand, used instead of the items above unless NULL
 };
 
 struct MeasurementSeries {
@@ -25,8 +25,52 @@
 #include "qcbor.h"
 #include "fingerprinter.h"
 
+#define CBOR_ERR_UART_TRANSMIT ((QCBORError) 200) //HAL_UART_Transmit failed, outside the range of QCBOR's own errors
+#define ENGINE_BUFFER_SIZE_MULTI 6400 //static engine buffer of convert_to_cbor_multi, larger output goes through convert_to_cbor_chunked
+
 QCBORError encodeAnalogMeasurement(UsefulBuf EngineBuffer, struct AnalogMeasurement *dataIn, UsefulBufC *EncodedCBOR, UART_HandleTypeDef *huart);
 
 QCBORError convert_to_cbor(Fingerprinter *fingerprint, UsefulBufC *buffer);
 
+// convert_to_cbor_direct into a static engine buffer of ENGINE_BUFFER_SIZE_MULTI bytes, output
+// that does not fit is rejected. buffer points into it, the next call overwrites it.
+QCBORError convert_to_cbor_multi(Fingerprinter **fingerprints, size_t count, UsefulBufC *buffer);
+
+// Encodes straight from the fingerprinter buffers, without building a struct
+// AnalogMeasurement and without its DEFAULT_MAX_QTY limits, and sends the output.
+// The caller provides EngineBuffer, get_encoded_size_bound tells how large it has to be,
+// already before the capture. buffer points into it and holds the output after it was sent.
+QCBORError convert_to_cbor_direct(Fingerprinter **fingerprints, size_t count, UsefulBuf EngineBuffer, UsefulBufC *buffer);
+
+// Bytes convert_to_cbor_direct produces at most, computed from the configuration alone, so
+// EngineBuffer can be sized before the capture. Measured metadata such as settle_us, vdda_mv,
+// temp_c, the phase times and delta_t count at their widest encoding, values as 3 byte
+// integers or varints, 9 byte doubles and 5 byte features. The series follow the last capture:
+// raw ones, or mean and variance once get_fingerprint_statistics ran.
+size_t get_encoded_size_bound(Fingerprinter **fingerprints, size_t count);
+
+// Exact number of bytes convert_to_cbor_direct produces for the captured buffers, 0 on error.
+// Runs the whole encoder in QCBOR's size calculation mode.
+size_t get_encoded_size_exact(Fingerprinter **fingerprints, size_t count);
+
+// Same for convert_to_cbor_chunked, whose indefinite-length arrays differ in their heads
+size_t get_encoded_size_chunked(Fingerprinter **fingerprints, size_t count);
+
+// Same content as convert_to_cbor_direct, but sent window by window while encoding. The
+// measurements and values arrays have indefinite length, so the output size is unbounded.
+// Stops at the first QCBOR or UART error and returns it, encoded_len counts the bytes sent
+// until then.
+QCBORError convert_to_cbor_chunked(Fingerprinter **fingerprints, size_t count, size_t *encoded_len);
+
+// StreamCallback for get_fingerprint_stream. The first block sends the head of an
+// AnalogMeasurement with one RegularMeasurementSeries, its Target and env-params, then every
+// block only adds its values to the open values array, sent through the chunk window. Raw
+// samples go out as integers whatever the value encoding, the stream length is not known ahead.
+void convert_block_to_cbor(Fingerprinter *fingerprint, const uint16_t *block, size_t length, size_t block_index);
+
+// Closes the stream with the trigger rate, also after get_fingerprint_stream failed, so the
+// output stays valid CBOR. Returns the first QCBOR or UART error of the whole stream,
+// encoded_len counts the bytes sent.
+QCBORError convert_stream_end_to_cbor(Fingerprinter *fingerprint, size_t *encoded_len);
+
 #endif /* INC_CDDLENCODER_H_ */
@@ -22,29 +22,235 @@
 #ifndef FINGERPRINTER_H_
 #define FINGERPRINTER_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+// Upper bound of loads converted by one ADC scan sequence, limited by the
+// four ranks of the injected group that probes the lines while they settle.
+// The last rank samples VREFINT.
+#define MAX_SCAN_CHANNELS (3)
+
+// Reference supply corrected samples are rescaled to, see set_supply_correction
+#define V_REF_MV (3300)
+
+// Bytes reserved for the encoded Target of a fingerprinter, longer ones are encoded every time
+#define TARGET_CBOR_SIZE (160)
+
+// Bytes reserved for all fingerprinter buffers, samples, timings and scan buffers
+#ifndef FINGERPRINTER_ARENA_SIZE
+#define FINGERPRINTER_ARENA_SIZE (16 * 1024)
+#endif
+
+typedef enum {
+	CAPTURE_POLLED,	// software-started single conversions (fallback)
+	CAPTURE_DMA,	// continuous conversions written by DMA in one burst
+	CAPTURE_TIMER_TRIGGERED,	// conversions triggered by trigger_timer TRGO at a fixed rate, written by DMA
+	CAPTURE_TIMESTAMPED,	// software-started single conversions, each timestamped at its end of conversion
+} CaptureMode;
+
+typedef enum {
+	ACQUISITION_FAST,	// raw single conversions
+	ACQUISITION_OVS_4,	// 4x hardware oversampling, right shift by 2
+	ACQUISITION_OVS_16,	// 16x hardware oversampling, right shift by 4
+	ACQUISITION_OVS_256,	// 256x hardware oversampling, right shift by 8
+} AcquisitionProfile;
+
+typedef enum {
+	TIMING_TIM1,	// delta_t in ticks of the 16 bit timer, 1 us with the default prescaler
+	TIMING_DWT,	// delta_t in CPU cycles of the 32 bit DWT cycle counter
+} TimingBackend;
+
+typedef enum {
+	PHASE_DISCHARGE,	// lines drawn low
+	PHASE_CHARGE,	// test pin driven high
+	PHASE_CAPTURE,	// capture started
+	PHASE_END,	// capture finished
+	NUM_OF_PHASE_MARKS,
+} TimingPhase;
+
+typedef enum {
+	RC_FEATURES_OFF,	// raw samples only
+	RC_FEATURES_ONLY,	// fitted RC curve features replace the raw samples
+	RC_FEATURES_WITH_RAW,	// fitted RC curve features in addition to the raw samples
+} RcFeatureMode;
+
+typedef enum {
+	RC_ASYMPTOTE,	// ADC counts the curve converges to
+	RC_OFFSET,	// ADC counts of the first conversion
+	RC_TAU_NS,	// time constant, 0 if the curve never reaches 63 % of its swing
+	RC_EARLY_SLOPE,	// ADC counts per millisecond over the first conversions
+	NUM_OF_RC_FEATURES,
+} RcFeature;
+
+typedef enum {
+	VALUES_INTEGERS,	// one CBOR integer per sample
+	VALUES_TYPED_ARRAY,	// one RFC 8746 uint16 little endian typed array
+	VALUES_DELTA_VARINT,	// first sample and differences, zigzag varints in one byte string
+} ValueEncoding;
+
+typedef enum {
+	FINGERPRINT_IDLE,	// no asynchronous capture started yet
+	FINGERPRINT_DISCHARGE,	// lines drawn low, waiting for them to settle
+	FINGERPRINT_RELEASE,	// operation pin released, waiting for the line to settle again
+	FINGERPRINT_READY,	// line settled, waiting for the ADC, interleaved captures only
+	FINGERPRINT_CAPTURE,	// test pin charged, DMA capture running
+	FINGERPRINT_DONE,	// all samples captured
+	FINGERPRINT_ERROR,	// capture aborted, see the UART for details
+} FingerprintState;
+
+// Register masks of one pin, precomputed so mode switches are plain register writes
 typedef struct {
+	unsigned long pin_mask;	// one bit per pin, as in OTYPER
+	unsigned long field_mask;	// two bits per pin, as in MODER, OSPEEDR and PUPDR
+	unsigned long output_bits;	// MODER value of general purpose output
+} GpioMasks;
+
+struct Fingerprinter;
+
+// Called from thread context, within poll_fingerprint_async, once an asynchronous capture finished
+typedef void (*FingerprintCallback)(struct Fingerprinter * fingerprint);
+
+// Called from thread context for every completed half of the streaming ring buffer
+typedef void (*StreamCallback)(struct Fingerprinter * fingerprint, const uint16_t * block,
+		size_t length, size_t block_index);
+
+typedef struct Fingerprinter {
 	const char * name;
 	unsigned int test_pin;
 	void * test_pin_bank;
 	unsigned int op_pin;
 	void * op_pin_bank;
+	GpioMasks test_pin_masks;
+	GpioMasks op_pin_masks;
 	void * timer;
 	void * adc;
+	unsigned int adc_channel;
+	AcquisitionProfile acquisition_profile;
 	void * uart;
 	unsigned int sample_size;
 	unsigned int num_of_samples;
-	unsigned int * samples;
+	uint16_t * samples;	// 12 bit conversions, also the DMA destination
 	unsigned long * delta_t;
+	unsigned long * sample_t;	// per conversion ticks since capture start, CAPTURE_TIMESTAMPED only
+	TimingBackend timing_backend;
+	unsigned long delta_t_hz;	// tick rate of delta_t
+	int phase_timing;
+	unsigned long * phase_t;	// NUM_OF_PHASE_MARKS cycle counter values per sample
+	unsigned long cycle_clock_hz;	// tick rate of phase_t
+	unsigned long capture_clock_hz;	// SYSCLK during the last capture
+	unsigned int repetitions;	// runs folded into the statistics, 0 after a raw capture
+	float * stat_mean;	// running mean per sample index
+	float * stat_m2;	// running sum of squared deviations per sample index
+	float stat_delta_t;	// running mean of delta_t
+	RcFeatureMode rc_feature_mode;
+	int32_t * rc_features;	// NUM_OF_RC_FEATURES values per sample
+	unsigned long * settle_t;	// ticks of the microsecond timer per sample, see get_settle_us
+	uint8_t * settle_timed_out;	// nonzero if settle_timeout_ms ran out before the lines settled
+	unsigned long settle_t_hz;	// clock of the microsecond timer while settle_t was counted
+	uint16_t * vrefint;	// VREFINT conversion of the last settle probe per sample, 0 if none
+	int supply_correction;	// samples rescaled from the measured VDDA to V_REF
+	uint16_t * ts_data;	// temperature sensor conversion right after each capture, 0 if none
+	ValueEncoding value_encoding;	// how raw samples are encoded
+	uint8_t * target_cbor;	// TARGET_CBOR_SIZE bytes, the encoded Target reused by every series
+	size_t target_cbor_len;	// 0 if the Target did not fit or no encoder is linked
+	uint32_t target_cbor_calfact;	// ADC calibration factor the cached Target holds
+	unsigned int settle_threshold;
+	unsigned int settle_timeout_ms;
+	CaptureMode capture_mode;
+	volatile int capture_done;
+	void * trigger_timer;
+	unsigned long sample_rate_hz;
+	double trigger_rate_hz;
+	volatile FingerprintState state;
+	FingerprintCallback on_complete;
+	int async_op_pin_mode;
+	size_t async_sample;
+	unsigned int settle_probes;
+	unsigned long settle_last;
+	unsigned long capture_start;
+	unsigned long phase_start_tick;
 } Fingerprinter;
 
 void print_string(void * uart, char const * string);
 
-void init_fingerprinter(Fingerprinter * fingerprint, const char * name, void * test_pin_bank,
+int init_fingerprinter(Fingerprinter * fingerprint, const char * name, void * test_pin_bank,
 		unsigned int test_pin, void * op_pin_bank, unsigned int op_pin, void * uart,
 		void * timer, void * adc, unsigned int sample_size, unsigned int num_of_samples);
 
+size_t get_fingerprinter_arena_free(void);
+
+// Starts the arena over. Every fingerprinter initialised so far points into freed memory
+// afterwards and has to go through init_fingerprinter again before its next use.
+void reset_fingerprinter_arena(void);
+
+void set_capture_mode(Fingerprinter * fingerprint, CaptureMode mode);
+
+// Rejects rates at which the acquisition profile cannot convert a sample between two triggers
+void set_trigger_timer(Fingerprinter * fingerprint, void * trigger_timer,
+		unsigned long sample_rate_hz);
+
+void set_settle_detection(Fingerprinter * fingerprint, unsigned int threshold,
+		unsigned int timeout_ms);
+
+void set_timing_backend(Fingerprinter * fingerprint, TimingBackend backend);
+
+void set_phase_timing(Fingerprinter * fingerprint, int enabled);
+
+unsigned long get_phase_cycles(const Fingerprinter * fingerprint, size_t sample_number,
+		TimingPhase phase);
+
+void set_rc_features(Fingerprinter * fingerprint, RcFeatureMode mode);
+
+void set_supply_correction(Fingerprinter * fingerprint, int enabled);
+
+void set_value_encoding(Fingerprinter * fingerprint, ValueEncoding encoding);
+
+// Settle time of a sample converted from timer ticks, whatever the timer clock was
+unsigned long get_settle_us(const Fingerprinter * fingerprint, size_t sample_number);
+
+unsigned long get_vdda_mv(const Fingerprinter * fingerprint, size_t sample_number);
+
+int get_temperature_c(const Fingerprinter * fingerprint, size_t sample_number,
+		int * temperature_c);
+
+void set_adc_channel(Fingerprinter * fingerprint, unsigned int adc_channel);
+
+void set_acquisition_profile(Fingerprinter * fingerprint, AcquisitionProfile profile);
+
+// Encodes the Target into target_cbor, called by init_fingerprinter and by every setter that
+// changes one of its items. Weak here, the CBOR encoder provides the encoding.
+void update_target_cache(Fingerprinter * fingerprint);
+
+const char * get_acquisition_profile_name(AcquisitionProfile profile);
+
+unsigned int get_oversampling_ratio(AcquisitionProfile profile);
+
 void get_and_print_fingerprint(Fingerprinter * fingerprint, int op_pin_mode);
 
 void get_fingerprint(Fingerprinter * fingerprint, int op_pin_mode);
 
+void get_fingerprint_scan(Fingerprinter ** fingerprints, size_t count,
+		const int * op_pin_modes);
+
+// Runs the loads one capture at a time, but discharges them concurrently
+int get_fingerprint_interleaved(Fingerprinter ** fingerprints, size_t count,
+		const int * op_pin_modes);
+
+int get_fingerprint_stream(Fingerprinter * fingerprint, int op_pin_mode, size_t num_of_blocks,
+		StreamCallback on_block);
+
+void get_fingerprint_statistics(Fingerprinter * fingerprint, int op_pin_mode,
+		unsigned int repetitions);
+
+float get_sample_variance(const Fingerprinter * fingerprint, size_t index);
+
+// Starts a CAPTURE_DMA or CAPTURE_TIMER_TRIGGERED capture and returns at once
+int start_fingerprint_async(Fingerprinter * fingerprint, int op_pin_mode,
+		FingerprintCallback on_complete);
+
+// Advances the asynchronous capture by the work the interrupts flagged, call it from the main loop
+FingerprintState poll_fingerprint_async(Fingerprinter * fingerprint);
+
+void fingerprinter_tick(void);
+
 #endif /* FINGERPRINTER_H_ */
@@ -37,6 +37,10 @@ extern "C" {
 
 /* Exported types ------------------------------------------------------------*/
 /* USER CODE BEGIN ET */
+typedef enum {
+	CLOCK_PROFILE_CAPTURE,	// 16 MHz HSI without PLL, low noise during the capture
+	CLOCK_PROFILE_PROCESSING,	// 80 MHz from the PLL for encoding and transmission
+} ClockProfile;
 
 /* USER CODE END ET */
 
@@ -54,6 +58,7 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
+void switch_clock_profile(ClockProfile profile);
 
 /* USER CODE END EFP */
 
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file sampleKernels.h
+* @brief Aggregation kernels for packed 16 bit ADC sample buffers. On cores
+* with the DSP extension they process two samples per instruction, every
+* kernel also has a portable *_ref version with identical results.
+* @version 1.0
+* @date 2026-10-17
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#ifndef SAMPLEKERNELS_H_
+#define SAMPLEKERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs of 12 bit samples a 16 bit ensemble accumulator can hold without overflow
+#define MAX_ENSEMBLE_RUNS (16)
+
+// Sum of all samples. The DSP versions of both sums multiply the samples as signed
+// halfwords, so they only match the references for 12 bit conversions (below 0x8000).
+uint32_t kernel_sum_u16(const uint16_t * samples, size_t length);
+uint32_t kernel_sum_u16_ref(const uint16_t * samples, size_t length);
+
+// Sum of all squared samples, for variances together with kernel_sum_u16
+uint64_t kernel_sum_squares_u16(const uint16_t * samples, size_t length);
+uint64_t kernel_sum_squares_u16_ref(const uint16_t * samples, size_t length);
+
+// accumulator[i] += samples[i], for at most MAX_ENSEMBLE_RUNS runs of 12 bit samples
+void kernel_accumulate_u16(uint16_t * accumulator, const uint16_t * samples, size_t length);
+void kernel_accumulate_u16_ref(uint16_t * accumulator, const uint16_t * samples, size_t length);
+
+// average[i] = accumulator[i] >> shift, the ensemble average over 2^shift runs
+void kernel_average_u16(uint16_t * average, const uint16_t * accumulator, size_t length,
+		unsigned int shift);
+void kernel_average_u16_ref(uint16_t * average, const uint16_t * accumulator, size_t length,
+		unsigned int shift);
+
+// difference[i] = a[i] - b[i]
+void kernel_subtract_u16(int16_t * difference, const uint16_t * a, const uint16_t * b,
+		size_t length);
+void kernel_subtract_u16_ref(int16_t * difference, const uint16_t * a, const uint16_t * b,
+		size_t length);
+
+// difference[i] = samples[i + 1] - samples[i], length - 1 values
+void kernel_first_difference_u16(int16_t * difference, const uint16_t * samples, size_t length);
+void kernel_first_difference_u16_ref(int16_t * difference, const uint16_t * samples,
+		size_t length);
+
+#endif /* SAMPLEKERNELS_H_ */
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file adcCalibration.c
+* @brief ADC offset calibration cached in the reserved last flash page
+* @version 1.0
+* @date 2026-10-17
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#include <adcCalibration.h>
+#include <stddef.h>
+
+#include "stm32l4xx_hal.h"
+#include "fingerprinter.h"
+
+// Records are appended to the page and only erased once it is full, the last valid one wins.
+// Low word: magic, high word: factor and its complement as a check.
+#define CALIBRATION_MAGIC (0xADC0CA1FUL)
+#define CALIBRATION_ERASED (0xFFFFFFFFUL)
+#define CALIBRATION_SLOTS (FLASH_PAGE_SIZE / sizeof(uint64_t))
+
+// Start of the CALIBRATION region, see STM32L432KCUX_FLASH.ld
+extern const uint64_t _calibration_page[];
+
+static uint32_t calibration_factor = 0;
+static AdcCalibrationSource calibration_source = ADC_CALIBRATION_NONE;
+static unsigned long recalibration_interval = DEFAULT_RECALIBRATION_INTERVAL_MS;
+static uint32_t last_calibration_tick = 0;
+static void * calibration_uart = NULL;
+
+static uint64_t make_record(uint32_t factor) {
+	uint32_t check = (factor & 0xFFFFU) | ((~factor & 0xFFFFU) << 16);
+	return ((uint64_t) check << 32) | CALIBRATION_MAGIC;
+}
+
+static int is_valid_record(uint64_t record) {
+	uint32_t check = (uint32_t) (record >> 32);
+	return (uint32_t) record == CALIBRATION_MAGIC &&
+			(check & 0xFFFFU) == (~check >> 16) && IS_ADC_CALFACT(check & 0xFFFFU);
+}
+
+// Index of the first erased slot, CALIBRATION_SLOTS if the page is full
+static size_t find_free_slot(void) {
+	size_t slot = 0;
+	while (slot < CALIBRATION_SLOTS && (uint32_t) _calibration_page[slot] != CALIBRATION_ERASED) {
+		slot++;
+	}
+	return slot;
+}
+
+static int load_factor(uint32_t * factor) {
+	size_t free_slot = find_free_slot();
+	for (size_t slot = free_slot; slot > 0; slot--) {
+		if (is_valid_record(_calibration_page[slot - 1])) {
+			*factor = (uint32_t) (_calibration_page[slot - 1] >> 32) & 0xFFFFU;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int store_factor(uint32_t factor) {
+	size_t slot = find_free_slot();
+	HAL_StatusTypeDef status = HAL_OK;
+
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+	if (slot == CALIBRATION_SLOTS) {
+		FLASH_EraseInitTypeDef erase = {0};
+		uint32_t page_error = 0;
+		erase.TypeErase = FLASH_TYPEERASE_PAGES;
+		erase.Banks = FLASH_BANK_1;
+		erase.Page = ((uint32_t) _calibration_page - FLASH_BASE) / FLASH_PAGE_SIZE;
+		erase.NbPages = 1;
+		status = HAL_FLASHEx_Erase(&erase, &page_error);
+		slot = 0;
+	}
+	if (status == HAL_OK) {
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD,
+				(uint32_t) &_calibration_page[slot], make_record(factor));
+	}
+	HAL_FLASH_Lock();
+
+	if (status != HAL_OK) {
+		print_string(calibration_uart, "[ERROR] ADC calibration could not be cached in flash\r\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int restore_factor(ADC_HandleTypeDef * adc, uint32_t factor) {
+	// CALFACT is only writable while the ADC is enabled, calibrate_adc leaves it disabled
+	if (ADC_Enable(adc) != HAL_OK) {
+		return -1;
+	}
+	HAL_StatusTypeDef status = HAL_ADCEx_Calibration_SetValue(adc, ADC_SINGLE_ENDED, factor);
+	if (ADC_Disable(adc) != HAL_OK || status != HAL_OK) {
+		return -1;
+	}
+	return 0;
+}
+
+int calibrate_adc(void * adc) {
+	if (HAL_ADCEx_Calibration_Start(adc, ADC_SINGLE_ENDED) != HAL_OK) {
+		print_string(calibration_uart, "[ERROR] ADC calibration failed\r\n");
+		return -1;
+	}
+	last_calibration_tick = HAL_GetTick();
+
+	uint32_t factor = HAL_ADCEx_Calibration_GetValue(adc, ADC_SINGLE_ENDED);
+	uint32_t cached = 0;
+	calibration_factor = factor;
+	calibration_source = ADC_CALIBRATION_MEASURED;
+	// Only a changed factor costs a flash write
+	if (load_factor(&cached) != 0 || cached != factor) {
+		return store_factor(factor);
+	}
+	return 0;
+}
+
+int init_adc_calibration(void * adc, void * uart, unsigned long recalibration_interval_ms) {
+	uint32_t factor = 0;
+
+	calibration_uart = uart;
+	recalibration_interval = recalibration_interval_ms;
+	if (load_factor(&factor) == 0 && restore_factor(adc, factor) == 0) {
+		calibration_factor = factor;
+		calibration_source = ADC_CALIBRATION_RESTORED;
+		last_calibration_tick = HAL_GetTick();
+		return 0;
+	}
+	return calibrate_adc(adc);
+}
+
+int maintain_adc_calibration(void * adc) {
+	if (recalibration_interval == 0 || calibration_source == ADC_CALIBRATION_NONE ||
+			HAL_GetTick() - last_calibration_tick < recalibration_interval) {
+		return 0;
+	}
+	return calibrate_adc(adc);
+}
+
+void set_adc_recalibration_interval(unsigned long interval_ms) {
+	recalibration_interval = interval_ms;
+}
+
+uint32_t get_adc_calibration_factor(void) {
+	return calibration_factor;
+}
+
+AdcCalibrationSource get_adc_calibration_source(void) {
+	return calibration_source;
+}
@@ -18,11 +18,26 @@
 * BSD-3-Clause).
 */
 
+#include <limits.h>//worst-case metadata in get_encoded_size_bound
 #include <stdio.h>//snprintf
+#include <string.h>//strlen
 #include "stm32l4xx_hal.h"
 
 #include <cddlEncoder.h>
+#include <adcCalibration.h>
 //#define CALCULATE_BUF_SIZE //determine the required size of EngineBuffer
+#define CHUNK_WINDOW_SIZE 256 //one fragment of convert_to_cbor_chunked: a Target, the env-params or a batch of values
+#define CHUNK_VALUES_PER_WINDOW 16 //values per batch, a timestamped entry takes at most 14 bytes
+#define DELTA_VARINT_MAX_BYTES 3 //zigzag of a difference of two uint16 samples needs at most 17 bits
+#define CBOR_UINT16_MAX_SIZE 3 //a uint16 sample as CBOR integer
+#define CBOR_INT32_MAX_SIZE 5 //an RC feature as CBOR integer
+#define CBOR_DOUBLE_MAX_SIZE 9 //a statistic, QCBOR picks the shortest float that keeps the value
+#define CBOR_TIME_MAX_SIZE 11 //a Time of a uint of up to 64 bit and a unit multiple of one byte
+#define ADC_CALFACT_MAX 0x7F //IS_ADC_CALFACT of the HAL, adc_calfact changes with every recalibration
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#error "typed-values are sent straight from the sample buffer and need a little endian core"
+#endif
 
 void encodeTime(QCBOREncodeContext *pCtx, struct Time *time, bool openInMap, int mapValue, UART_HandleTypeDef *huart) {
 	if (openInMap) {
@@ -112,12 +127,16 @@ QCBORError encodeAnalogMeasurement(UsefulBuf EngineBuffer, struct AnalogMeasurem
 	QCBOREncode_OpenArray(&EncodeCtx);//measurements: [ * MeasurementSeries ]
 	for (size_t i = 0; i < dataIn->AnalogMeasurement_measurements_MeasurementSeries_m_count; i++) {
 		struct MeasurementSeries *tmpMs = &(dataIn->AnalogMeasurement_measurements_MeasurementSeries_m[i]);
-		QCBOREncode_OpenArray(&EncodeCtx);//target: Target
-		QCBOREncode_AddText(&EncodeCtx, tmpMs->MeasurementSeries_target.Target_id);//works like QCBOREncode_AddSZString; CBOR major type 3
-		if (tmpMs->MeasurementSeries_target.Target_config_params_present) {
-			encodeParams(&EncodeCtx, &(tmpMs->MeasurementSeries_target.Target_config_params), huart);//config-params: [ * NameValuePair ]
+		if (!UsefulBuf_IsNULLC(tmpMs->MeasurementSeries_target.Target_encoded)) {
+			QCBOREncode_AddEncoded(&EncodeCtx, tmpMs->MeasurementSeries_target.Target_encoded);//target: Target
+		}else {
+			QCBOREncode_OpenArray(&EncodeCtx);//target: Target
+			QCBOREncode_AddText(&EncodeCtx, tmpMs->MeasurementSeries_target.Target_id);//works like QCBOREncode_AddSZString; CBOR major type 3
+			if (tmpMs->MeasurementSeries_target.Target_config_params_present) {
+				encodeParams(&EncodeCtx, &(tmpMs->MeasurementSeries_target.Target_config_params), huart);//config-params: [ * NameValuePair ]
+			}
+			QCBOREncode_CloseArray(&EncodeCtx);//target: Target
 		}
-		QCBOREncode_CloseArray(&EncodeCtx);//target: Target
 		if (tmpMs->MeasurementSeries_env_params_present) {
 			encodeParams(&EncodeCtx, &(tmpMs->MeasurementSeries_env_params), huart);//?env-params: [ * NameValuePair ]
 		}
@@ -191,77 +210,686 @@ QCBORError encodeAnalogMeasurement(UsefulBuf EngineBuffer, struct AnalogMeasurem
 }
 
 
+static uint64_t ticksToNanos(unsigned long ticks, unsigned long tick_hz) {
+	if (tick_hz == 0) {
+		return 0;
+	}
+	return ((uint64_t)ticks * 1000000000ULL + tick_hz / 2) / tick_hz;
+}
+
+static void setDuration(struct Time *time, unsigned long ticks, unsigned long tick_hz) {
+	time->Time_seconds_choice = Time_seconds_uint_c;
+	if (tick_hz == 1000000) {//1 MHz timer ticks are exact microseconds
+		time->Time_seconds_uint = ticks;
+		time->Time_unit_mult = UNIT_MULTIPLE_SI_MICRO_c;
+	}else {//cycle counts, rounded to nanoseconds
+		time->Time_seconds_uint = ticksToNanos(ticks, tick_hz);
+		time->Time_unit_mult = UNIT_MULTIPLE_SI_NANO_c;
+	}
+}
+
+static size_t seriesOf(Fingerprinter *fingerprint) {
+	if (fingerprint->repetitions > 0) {
+		return 2;//mean and variance replace the raw samples
+	}
+	if (fingerprint->rc_feature_mode == RC_FEATURES_WITH_RAW) {
+		return 2 * fingerprint->num_of_samples;//raw series, each followed by its features
+	}
+	return fingerprint->num_of_samples;
+}
+
+static bool isFeatureSeries(Fingerprinter *fingerprint, size_t series) {
+	if (fingerprint->repetitions > 0) {
+		return false;
+	}
+	return fingerprint->rc_feature_mode == RC_FEATURES_ONLY ||
+			(fingerprint->rc_feature_mode == RC_FEATURES_WITH_RAW && series % 2 == 1);
+}
+
+static size_t sampleOf(Fingerprinter *fingerprint, size_t series) {
+	if (fingerprint->repetitions > 0) {
+		return 0;//statistics runs all reuse the first sample
+	}
+	return fingerprint->rc_feature_mode == RC_FEATURES_WITH_RAW ? series / 2 : series;
+}
+
+static void addNamedUInt(QCBOREncodeContext *pCtx, const char *name, uint64_t value) {//one NameValuePair
+	QCBOREncode_AddSZString(pCtx, name);
+	QCBOREncode_AddUInt64(pCtx, value);
+}
+
+static void addNamedInt(QCBOREncodeContext *pCtx, const char *name, int64_t value) {//one NameValuePair
+	QCBOREncode_AddSZString(pCtx, name);
+	QCBOREncode_AddInt64(pCtx, value);
+}
+
+static void addNamedText(QCBOREncodeContext *pCtx, const char *name, const char *value) {//one NameValuePair
+	QCBOREncode_AddSZString(pCtx, name);
+	QCBOREncode_AddSZString(pCtx, value);
+}
+
+static void encodeTargetDirect(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint) {//Target id and config-params
+	QCBOREncode_OpenArray(pCtx);//target: Target
+	QCBOREncode_AddSZString(pCtx, fingerprint->name);
+	QCBOREncode_OpenArray(pCtx);//config-params: [ * NameValuePair ]
+	addNamedInt(pCtx, "test_pin", fingerprint->test_pin);
+	addNamedInt(pCtx, "test_pin_bank", (unsigned long)fingerprint->test_pin_bank);
+	addNamedInt(pCtx, "op_pin", fingerprint->op_pin);
+	addNamedInt(pCtx, "op_pin_bank", (unsigned long)fingerprint->op_pin_bank);
+	addNamedText(pCtx, "acq_profile", get_acquisition_profile_name(fingerprint->acquisition_profile));
+	addNamedUInt(pCtx, "ovs_ratio", get_oversampling_ratio(fingerprint->acquisition_profile));
+	addNamedUInt(pCtx, "adc_calfact", get_adc_calibration_factor());
+	QCBOREncode_CloseArray(pCtx);//config-params: [ * NameValuePair ]
+	QCBOREncode_CloseArray(pCtx);//target: Target
+}
+
+void update_target_cache(Fingerprinter *fingerprint) {//replaces the weak one of fingerprinter.c
+	QCBOREncodeContext TargetCtx;
+	UsefulBufC target;
+	fingerprint->target_cbor_len = 0;
+	if (fingerprint->target_cbor == NULL) {
+		return;
+	}
+	QCBOREncode_Init(&TargetCtx, (UsefulBuf){fingerprint->target_cbor, TARGET_CBOR_SIZE});
+	encodeTargetDirect(&TargetCtx, fingerprint);
+	if (QCBOREncode_Finish(&TargetCtx, &target) == QCBOR_SUCCESS) {//too long for the cache otherwise
+		fingerprint->target_cbor_len = target.len;
+		fingerprint->target_cbor_calfact = get_adc_calibration_factor();
+	}
+}
+
+static UsefulBufC cachedTargetOf(Fingerprinter *fingerprint) {//NULLUsefulBufC if the Target has to be encoded item by item
+	if (fingerprint->target_cbor_len != 0 && fingerprint->target_cbor_calfact != get_adc_calibration_factor()) {//recalibration changes adc_calfact
+		update_target_cache(fingerprint);
+	}
+	if (fingerprint->target_cbor_len == 0) {
+		return NULLUsefulBufC;
+	}
+	return (UsefulBufC){fingerprint->target_cbor, fingerprint->target_cbor_len};
+}
+
+static void encodeTargetCached(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint) {//splices the encoded Target in, encodes it only once per configuration
+	UsefulBufC target = cachedTargetOf(fingerprint);
+	if (UsefulBuf_IsNULLC(target)) {
+		encodeTargetDirect(pCtx, fingerprint);
+		return;
+	}
+	QCBOREncode_AddEncoded(pCtx, target);//target: Target
+}
+
+static void encodeEnvParamsDirect(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint, size_t series, size_t sample) {
+	QCBOREncode_OpenArray(pCtx);//?env-params: [ * NameValuePair ]
+	addNamedUInt(pCtx, "settle_us", get_settle_us(fingerprint, sample));
+	QCBOREncode_AddSZString(pCtx, "settle_timeout");//the lines did not settle within settle_timeout_ms
+	QCBOREncode_AddBool(pCtx, fingerprint->settle_timed_out[sample] != 0);
+	addNamedUInt(pCtx, "sysclk_hz", fingerprint->capture_clock_hz);
+	addNamedUInt(pCtx, "vdda_mv", get_vdda_mv(fingerprint, sample));
+	int temperature_c = 0;
+	if (get_temperature_c(fingerprint, sample, &temperature_c) == 0) {
+		addNamedInt(pCtx, "temp_c", temperature_c);
+	}
+	if (fingerprint->supply_correction) {
+		addNamedUInt(pCtx, "corrected_to_mv", V_REF_MV);
+	}
+	if (fingerprint->repetitions > 0) {
+		addNamedText(pCtx, "statistic", (series == 0) ? "mean" : "variance");
+		addNamedUInt(pCtx, "repetitions", fingerprint->repetitions);
+	}else if (isFeatureSeries(fingerprint, series)) {
+		addNamedText(pCtx, "rc_features", "asymptote offset tau_ns slope_per_ms");
+	}
+	if (fingerprint->phase_timing) {
+		addNamedUInt(pCtx, "discharge_ns", ticksToNanos(get_phase_cycles(fingerprint, sample, PHASE_DISCHARGE), fingerprint->cycle_clock_hz));
+		addNamedUInt(pCtx, "charge_ns", ticksToNanos(get_phase_cycles(fingerprint, sample, PHASE_CHARGE), fingerprint->cycle_clock_hz));
+		addNamedUInt(pCtx, "capture_ns", ticksToNanos(get_phase_cycles(fingerprint, sample, PHASE_CAPTURE), fingerprint->cycle_clock_hz));
+	}
+	QCBOREncode_CloseArray(pCtx);//?env-params: [ * NameValuePair ]
+}
+
+static void encodeDurationDirect(QCBOREncodeContext *pCtx, unsigned long ticks, unsigned long tick_hz, bool openInMap, int mapValue, UART_HandleTypeDef *huart) {
+	struct Time time;
+	setDuration(&time, ticks, tick_hz);
+	encodeTime(pCtx, &time, openInMap, mapValue, huart);
+}
+
+static void encodeFrequencyDirect(QCBOREncodeContext *pCtx, double rate_hz) {
+	QCBOREncode_OpenArray(pCtx);//Frequency
+	if (rate_hz == (double)(uint64_t)rate_hz) {
+		QCBOREncode_AddUInt64(pCtx, (uint64_t)rate_hz);
+	}else {
+		QCBOREncode_AddDouble(pCtx, rate_hz);
+	}
+	QCBOREncode_AddInt64(pCtx, UNIT_MULTIPLE_SI_BASE_c);
+	QCBOREncode_CloseArray(pCtx);//Frequency
+}
+
+static bool isIrregularSeries(Fingerprinter *fingerprint, size_t series) {
+	return fingerprint->repetitions == 0 && !isFeatureSeries(fingerprint, series) &&
+			fingerprint->capture_mode == CAPTURE_TIMESTAMPED && fingerprint->sample_t != NULL;
+}
+
+static size_t valuesOf(Fingerprinter *fingerprint, size_t series) {
+	return isFeatureSeries(fingerprint, series) ? NUM_OF_RC_FEATURES : fingerprint->sample_size;
+}
+
+static bool isPackedSeries(Fingerprinter *fingerprint, size_t series) {//raw samples that go out as one byte string
+	return fingerprint->value_encoding != VALUES_INTEGERS && fingerprint->repetitions == 0 &&
+			!isFeatureSeries(fingerprint, series) && !isIrregularSeries(fingerprint, series);
+}
+
+static const uint16_t *samplesOf(Fingerprinter *fingerprint, size_t series) {
+	return &(fingerprint->samples[sampleOf(fingerprint, series) * fingerprint->sample_size]);
+}
+
+static UsefulBufC typedValuesOf(Fingerprinter *fingerprint, size_t series) {//the sample buffer itself, the core is little endian
+	return (UsefulBufC){samplesOf(fingerprint, series), fingerprint->sample_size * sizeof(uint16_t)};
+}
+
+static size_t packDeltaVarints(uint8_t *out, size_t out_len, const uint16_t *samples, size_t from, size_t to) {//delta-values bytes of samples [from, to), only counted beyond out_len
+	size_t len = 0;
+	for (size_t j = from; j < to; j++) {
+		int32_t delta = (int32_t)samples[j] - ((j > 0) ? (int32_t)samples[j - 1] : 0);//the first value is its delta to 0
+		uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		do {
+			uint8_t byte = zigzag & 0x7F;
+			zigzag >>= 7;
+			if (zigzag != 0) {
+				byte |= 0x80;//more bytes follow
+			}
+			if (len < out_len) {
+				out[len] = byte;
+			}
+			len++;
+		} while (zigzag != 0);
+	}
+	return len;
+}
+
+static void encodePackedValuesDirect(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint, size_t series) {//typed-values or delta-values key and value
+	if (fingerprint->value_encoding == VALUES_TYPED_ARRAY) {
+		QCBOREncode_AddInt64(pCtx, typed_values_map);
+		QCBOREncode_AddTag(pCtx, TYPED_ARRAY_UINT16_LE_TAG);
+		QCBOREncode_AddBytes(pCtx, typedValuesOf(fingerprint, series));//typed-values => uint16-le-array
+	}else {
+		UsefulBuf place;
+		QCBOREncode_AddInt64(pCtx, delta_values_map);
+		QCBOREncode_OpenBytes(pCtx, &place);//packed in place, without a copy
+		//place.ptr is NULL while only the size is calculated or once the buffer is full
+		size_t len = packDeltaVarints(place.ptr, (place.ptr == NULL) ? 0 : place.len,
+				samplesOf(fingerprint, series), 0, fingerprint->sample_size);
+		QCBOREncode_CloseBytes(pCtx, len);//delta-values => delta-varint-array
+	}
+}
+
+static void encodeSeriesHeadDirect(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint, size_t series) {//target, env-params, unit and unit-multiple
+	encodeTargetCached(pCtx, fingerprint);
+	encodeEnvParamsDirect(pCtx, fingerprint, series, sampleOf(fingerprint, series));
+	QCBOREncode_AddUInt64(pCtx, UNIT_ELECTRICAL_SI_NONE_c);//unit: Unit
+	QCBOREncode_AddInt64(pCtx, UNIT_MULTIPLE_SI_BASE_c);//unit-multiple: UnitMultiple
+}
+
+static void encodeValuesDirect(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint, size_t series, size_t from, size_t to) {//values [from, to) of a series, as NumericalValues or IrregularMeasurementSeries entries
+	size_t sample = sampleOf(fingerprint, series);
+	const uint16_t *samples = &(fingerprint->samples[sample * fingerprint->sample_size]);
+
+	if (isIrregularSeries(fingerprint, series)) {
+		const unsigned long *sample_t = &(fingerprint->sample_t[sample * fingerprint->sample_size]);
+		for (size_t j = from; j < to; j++) {
+			encodeDurationDirect(pCtx, sample_t[j], fingerprint->delta_t_hz, false, 0, fingerprint->uart);//current-time: Time
+			QCBOREncode_AddInt64(pCtx, samples[j]);//NumericalValue
+		}
+	}else if (fingerprint->repetitions > 0) {
+		for (size_t j = from; j < to; j++) {
+			QCBOREncode_AddDouble(pCtx, (series == 0) ? fingerprint->stat_mean[j] : get_sample_variance(fingerprint, j));
+		}
+	}else if (isFeatureSeries(fingerprint, series)) {
+		for (size_t j = from; j < to; j++) {
+			QCBOREncode_AddInt64(pCtx, fingerprint->rc_features[j + (sample * NUM_OF_RC_FEATURES)]);
+		}
+	}else {
+		for (size_t j = from; j < to; j++) {
+			QCBOREncode_AddInt64(pCtx, samples[j]);
+		}
+	}
+}
+
+static void encodeIntervalDirect(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint, size_t series) {//interval/frequency/duration key and value of a RegularMeasurementSeries
+	if (fingerprint->repetitions > 0) {
+		QCBOREncode_AddInt64(pCtx, interval_frequency_duration_duration_c);
+		encodeDurationDirect(pCtx, (unsigned long)(fingerprint->stat_delta_t + 0.5f), fingerprint->delta_t_hz, false, 0, fingerprint->uart);
+	}else if (!isFeatureSeries(fingerprint, series) && fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED) {//samples are equidistant at the trigger rate
+		QCBOREncode_AddInt64(pCtx, interval_frequency_duration_frequency_c);
+		encodeFrequencyDirect(pCtx, fingerprint->trigger_rate_hz);
+	}else {
+		QCBOREncode_AddInt64(pCtx, interval_frequency_duration_duration_c);
+		encodeDurationDirect(pCtx, fingerprint->delta_t[sampleOf(fingerprint, series)], fingerprint->delta_t_hz, false, 0, fingerprint->uart);
+	}
+}
+
+static void encodeSeriesDirect(QCBOREncodeContext *pCtx, Fingerprinter *fingerprint, size_t series) {//one MeasurementSeries straight from the fingerprinter buffers
+	encodeSeriesHeadDirect(pCtx, fingerprint, series);
+	if (isIrregularSeries(fingerprint, series)) {
+		QCBOREncode_OpenArray(pCtx);//measurements: IrregularMeasurementSeries
+		encodeValuesDirect(pCtx, fingerprint, series, 0, valuesOf(fingerprint, series));
+		QCBOREncode_CloseArray(pCtx);//measurements: IrregularMeasurementSeries
+	}else {
+		QCBOREncode_OpenMap(pCtx);//measurements: RegularMeasurementSeries
+		if (isPackedSeries(fingerprint, series)) {
+			encodePackedValuesDirect(pCtx, fingerprint, series);
+		}else {
+			QCBOREncode_OpenArrayInMapN(pCtx, values_map);//values => [ * NumericalValue ]
+			encodeValuesDirect(pCtx, fingerprint, series, 0, valuesOf(fingerprint, series));
+			QCBOREncode_CloseArray(pCtx);//values => [ * NumericalValue ]
+		}
+		encodeIntervalDirect(pCtx, fingerprint, series);
+		QCBOREncode_CloseMap(pCtx);//measurements: RegularMeasurementSeries
+	}
+}
+
+static QCBORError transmitEncoded(UART_HandleTypeDef *huart, UsefulBufC encoded) {//in CHUNK_WINDOW_SIZE slices, each well within the UART timeout
+	for (size_t offset = 0; offset < encoded.len; offset += CHUNK_WINDOW_SIZE) {
+		size_t len = (encoded.len - offset > CHUNK_WINDOW_SIZE) ? CHUNK_WINDOW_SIZE : encoded.len - offset;
+		if (HAL_UART_Transmit(huart, (uint8_t *) encoded.ptr + offset, len, 100) != HAL_OK) {
+			return CBOR_ERR_UART_TRANSMIT;
+		}
+	}
+	return QCBOR_SUCCESS;
+}
+
+static void encodeAnalogMeasurementDirect(QCBOREncodeContext *pCtx, Fingerprinter **fingerprints, size_t count) {
+	QCBOREncode_OpenArray(pCtx);//AnalogMeasurement
+	QCBOREncode_AddUInt64(pCtx, 1);//version-tag
+	struct Time start_time = {
+		.Time_seconds_choice = Time_seconds_uint_c,
+		.Time_seconds_uint = 0,
+		.Time_unit_mult = UNIT_MULTIPLE_SI_MILLI_c
+	};
+	encodeTime(pCtx, &start_time, false, 0, fingerprints[0]->uart);//start-time: Time
+	QCBOREncode_OpenArray(pCtx);//measurements: [ * MeasurementSeries ]
+	for (size_t f=0; f<count; f++) {
+		for (size_t i=0; i<seriesOf(fingerprints[f]); i++) {
+			encodeSeriesDirect(pCtx, fingerprints[f], i);
+		}
+	}
+	QCBOREncode_CloseArray(pCtx);//measurements: [ * MeasurementSeries ]
+	QCBOREncode_CloseArray(pCtx);//AnalogMeasurement
+}
+
+static size_t cborHeadSize(uint64_t argument) {//initial byte plus argument: a value, a length or a number of items
+	if (argument < 24) {
+		return 1;
+	}else if (argument <= UINT8_MAX) {
+		return 2;
+	}else if (argument <= UINT16_MAX) {
+		return 3;
+	}else if (argument <= UINT32_MAX) {
+		return 5;
+	}
+	return 9;
+}
+
+static size_t cborIntSize(int64_t value) {
+	return cborHeadSize((value < 0) ? (uint64_t)(-1 - value) : (uint64_t)value);
+}
+
+static size_t cborTextSize(const char *text) {
+	size_t len = strlen(text);
+	return cborHeadSize(len) + len;
+}
+
+static size_t timeSize(const struct Time *time) {//a uint Time as encodeTime writes it
+	return 1 + cborHeadSize(time->Time_seconds_uint) + cborIntSize(time->Time_unit_mult);
+}
+
+static size_t targetSize(Fingerprinter *fingerprint) {//the cached length with adc_calfact at its widest, only a missing cache needs a size-only encoding
+	UsefulBufC target = cachedTargetOf(fingerprint);
+	size_t size = target.len;
+	if (UsefulBuf_IsNULLC(target)) {
+		QCBOREncodeContext SizeCtx;
+		QCBOREncode_Init(&SizeCtx, SizeCalculateUsefulBuf);
+		encodeTargetDirect(&SizeCtx, fingerprint);
+		QCBOREncode_FinishGetSize(&SizeCtx, &size);
+	}
+	return size - cborHeadSize(get_adc_calibration_factor()) + cborHeadSize(ADC_CALFACT_MAX);
+}
+
+static size_t envParamsSize(Fingerprinter *fingerprint, size_t series) {//same items as encodeEnvParamsDirect, the measured ones at their widest
+	size_t pairs = 5;
+	size_t size = cborTextSize("settle_us") + cborHeadSize(ULONG_MAX) +
+			cborTextSize("settle_timeout") + 1 +
+			cborTextSize("sysclk_hz") + cborHeadSize(ULONG_MAX) +
+			cborTextSize("vdda_mv") + cborHeadSize(ULONG_MAX) +
+			cborTextSize("temp_c") + cborIntSize(INT_MIN);//also when the sensor could not be read
+	if (fingerprint->supply_correction) {
+		pairs++;
+		size += cborTextSize("corrected_to_mv") + cborHeadSize(V_REF_MV);
+	}
+	if (fingerprint->repetitions > 0) {
+		pairs += 2;
+		size += cborTextSize("statistic") + cborTextSize((series == 0) ? "mean" : "variance") +
+				cborTextSize("repetitions") + cborHeadSize(UINT_MAX);
+	}else if (isFeatureSeries(fingerprint, series)) {
+		pairs++;
+		size += cborTextSize("rc_features") + cborTextSize("asymptote offset tau_ns slope_per_ms");
+	}
+	if (fingerprint->phase_timing) {
+		pairs += 3;
+		size += cborTextSize("discharge_ns") + cborTextSize("charge_ns") + cborTextSize("capture_ns") +
+				3 * cborHeadSize(UINT64_MAX);
+	}
+	return cborHeadSize(2 * pairs) + size;
+}
+
+static size_t intervalSize(Fingerprinter *fingerprint, size_t series) {//same choice as encodeIntervalDirect
+	if (fingerprint->repetitions > 0) {
+		return cborIntSize(interval_frequency_duration_duration_c) + CBOR_TIME_MAX_SIZE;
+	}else if (!isFeatureSeries(fingerprint, series) && fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED) {
+		//the rate achieved at the capture clock, it need not be integral
+		return cborIntSize(interval_frequency_duration_frequency_c) + 1 + CBOR_DOUBLE_MAX_SIZE + cborIntSize(UNIT_MULTIPLE_SI_BASE_c);
+	}
+	return cborIntSize(interval_frequency_duration_duration_c) + CBOR_TIME_MAX_SIZE;//delta_t is only known after the capture
+}
+
+static size_t measurementsSize(Fingerprinter *fingerprint, size_t series) {//the values exact for a typed array, an upper bound otherwise
+	size_t values = valuesOf(fingerprint, series);
+	if (isIrregularSeries(fingerprint, series)) {
+		return cborHeadSize(2 * values) + values * (CBOR_TIME_MAX_SIZE + CBOR_UINT16_MAX_SIZE);
+	}
+
+	size_t size = 1 + intervalSize(fingerprint, series);//map head of a RegularMeasurementSeries
+	if (isPackedSeries(fingerprint, series)) {
+		if (fingerprint->value_encoding == VALUES_TYPED_ARRAY) {
+			size_t len = values * sizeof(uint16_t);
+			return size + cborIntSize(typed_values_map) + cborHeadSize(TYPED_ARRAY_UINT16_LE_TAG) + cborHeadSize(len) + len;
+		}
+		size_t len = values * DELTA_VARINT_MAX_BYTES;
+		return size + cborIntSize(delta_values_map) + cborHeadSize(len) + len;
+	}
+
+	size_t value_size = CBOR_UINT16_MAX_SIZE;
+	if (fingerprint->repetitions > 0) {
+		value_size = CBOR_DOUBLE_MAX_SIZE;
+	}else if (isFeatureSeries(fingerprint, series)) {
+		value_size = CBOR_INT32_MAX_SIZE;
+	}
+	return size + cborIntSize(values_map) + cborHeadSize(values) + values * value_size;
+}
+
+static size_t seriesSize(Fingerprinter *fingerprint, size_t series) {//same items as encodeSeriesDirect
+	return targetSize(fingerprint) + envParamsSize(fingerprint, series) +
+			cborHeadSize(UNIT_ELECTRICAL_SI_NONE_c) + cborIntSize(UNIT_MULTIPLE_SI_BASE_c) +
+			measurementsSize(fingerprint, series);
+}
+
+size_t get_encoded_size_bound(Fingerprinter **fingerprints, size_t count) {
+	struct Time start_time = {
+		.Time_seconds_choice = Time_seconds_uint_c,
+		.Time_seconds_uint = 0,
+		.Time_unit_mult = UNIT_MULTIPLE_SI_MILLI_c
+	};
+	size_t num_of_series = 0;
+	size_t size = 0;
+	for (size_t f=0; f<count; f++) {
+		for (size_t i=0; i<seriesOf(fingerprints[f]); i++) {
+			size += seriesSize(fingerprints[f], i);
+			num_of_series++;
+		}
+	}
+	//AnalogMeasurement head, version-tag and start-time, then the measurements array holding
+	//the five items of every series: target, env-params, unit, unit-multiple and measurements
+	return 1 + cborHeadSize(1) + timeSize(&start_time) + cborHeadSize(5 * num_of_series) + size;
+}
+
+size_t get_encoded_size_exact(Fingerprinter **fingerprints, size_t count) {
+	QCBOREncodeContext SizeCtx;
+	QCBOREncode_Init(&SizeCtx, SizeCalculateUsefulBuf);//nothing is written, QCBOR only tracks the length
+	encodeAnalogMeasurementDirect(&SizeCtx, fingerprints, count);
+	size_t size = 0;
+	if (QCBOREncode_FinishGetSize(&SizeCtx, &size) != QCBOR_SUCCESS) {
+		return 0;
+	}
+	return size;
+}
+
+QCBORError convert_to_cbor_direct(Fingerprinter **fingerprints, size_t count, UsefulBuf EngineBuffer, UsefulBufC *buffer) {
+	QCBOREncodeContext EncodeCtx;
+	QCBOREncode_Init(&EncodeCtx, EngineBuffer);
+	encodeAnalogMeasurementDirect(&EncodeCtx, fingerprints, count);
+
+	QCBORError err = QCBOREncode_Finish(&EncodeCtx, buffer);
+	if (err != QCBOR_SUCCESS) {
+		print_string(fingerprints[0]->uart, "[ERROR] AnalogMeasurement does not fit into EngineBuffer\n");
+		return err;
+	}
+	return transmitEncoded(fingerprints[0]->uart, *buffer);
+}
+
 QCBORError convert_to_cbor(Fingerprinter *fingerprint, UsefulBufC *buffer) {
-	struct AnalogMeasurement tmp = {
-		.AnalogMeasurement_version_tag = 1,
-		.AnalogMeasurement_start_time = {
-			.Time_seconds_choice = Time_seconds_uint_c,
-			.Time_seconds_uint = 0,
-			.Time_unit_mult = UNIT_MULTIPLE_SI_MILLI_c
-		},
-		.AnalogMeasurement_measurements_MeasurementSeries_m_count = fingerprint->num_of_samples,
+	return convert_to_cbor_multi(&fingerprint, 1, buffer);
+}
+
+QCBORError convert_to_cbor_multi(Fingerprinter **fingerprints, size_t count, UsefulBufC *buffer) {
+	static uint8_t engine_buffer[ENGINE_BUFFER_SIZE_MULTI];//also holds the output after returning
+	return convert_to_cbor_direct(fingerprints, count, (UsefulBuf){engine_buffer, sizeof(engine_buffer)}, buffer);
+}
+
+typedef struct {
+	QCBOREncodeContext ctx;
+	UsefulBuf window;
+	UART_HandleTypeDef *huart;
+	bool count_only;//size calculation, nothing is written or sent
+	size_t sent;
+	QCBORError err;
+} ChunkEncoder;
+
+static const uint8_t CBOR_INDEFINITE_ARRAY = 0x9F;//array of indefinite length, closed by CBOR_BREAK
+static const uint8_t CBOR_BREAK = 0xFF;
+static const uint8_t CBOR_ANALOG_MEASUREMENT_HEAD = 0x83;//array of 3: version-tag, start-time, measurements
+static const uint8_t CBOR_REGULAR_SERIES_HEAD = 0xA2;//map of 2: values, interval-frequency-duration
+
+static void chunkAddRaw(ChunkEncoder *enc, const uint8_t *byte) {//a head QCBOR cannot leave open across windows
+	QCBOREncode_AddEncoded(&(enc->ctx), (UsefulBufC){byte, 1});
+}
+
+static void chunkSendBytes(ChunkEncoder *enc, UsefulBufC bytes) {//in CHUNK_WINDOW_SIZE slices, each well within the UART timeout
+	for (size_t offset = 0; offset < bytes.len && enc->err == QCBOR_SUCCESS; offset += CHUNK_WINDOW_SIZE) {
+		size_t len = (bytes.len - offset > CHUNK_WINDOW_SIZE) ? CHUNK_WINDOW_SIZE : bytes.len - offset;
+		if (!enc->count_only && HAL_UART_Transmit(enc->huart, (uint8_t *) bytes.ptr + offset, len, 100) != HAL_OK) {
+			enc->err = CBOR_ERR_UART_TRANSMIT;//the output is broken from here on
+			return;
+		}
+		enc->sent += len;
+	}
+}
+
+static void chunkFlush(ChunkEncoder *enc) {//send the filled window and start over with an empty one
+	if (enc->err == QCBOR_SUCCESS) {
+		UsefulBufC fragment = NULLUsefulBufC;
+		QCBORError err;
+		if (enc->count_only) {
+			err = QCBOREncode_FinishGetSize(&(enc->ctx), &(fragment.len));
+		}else {
+			err = QCBOREncode_Finish(&(enc->ctx), &fragment);
+		}
+		if (err == QCBOR_SUCCESS) {
+			chunkSendBytes(enc, fragment);
+		}else {
+			enc->err = err;//nothing more is sent after the first error
+		}
+	}
+	QCBOREncode_Init(&(enc->ctx), enc->window);
+}
+
+static void encodePackedValuesChunked(ChunkEncoder *enc, Fingerprinter *fingerprint, size_t series) {//the byte string head in the window, its content sent around it
+	QCBOREncodeContext *pCtx = &(enc->ctx);
+	if (fingerprint->value_encoding == VALUES_TYPED_ARRAY) {
+		UsefulBufC typed_values = typedValuesOf(fingerprint, series);
+		QCBOREncode_AddInt64(pCtx, typed_values_map);
+		QCBOREncode_AddTag(pCtx, TYPED_ARRAY_UINT16_LE_TAG);
+		QCBOREncode_AddBytesLenOnly(pCtx, typed_values);//typed-values => uint16-le-array
+		chunkFlush(enc);
+		chunkSendBytes(enc, typed_values);//straight from the sample buffer
+	}else {
+		const uint16_t *samples = samplesOf(fingerprint, series);
+		size_t values = fingerprint->sample_size;
+		uint8_t packed[CHUNK_VALUES_PER_WINDOW * DELTA_VARINT_MAX_BYTES];
+		QCBOREncode_AddInt64(pCtx, delta_values_map);
+		QCBOREncode_AddBytesLenOnly(pCtx, (UsefulBufC){NULL, packDeltaVarints(NULL, 0, samples, 0, values)});//delta-values => delta-varint-array
+		chunkFlush(enc);
+		for (size_t from = 0; from < values && enc->err == QCBOR_SUCCESS; from += CHUNK_VALUES_PER_WINDOW) {
+			size_t to = (values - from > CHUNK_VALUES_PER_WINDOW) ? from + CHUNK_VALUES_PER_WINDOW : values;
+			chunkSendBytes(enc, (UsefulBufC){packed, packDeltaVarints(packed, sizeof(packed), samples, from, to)});
+		}
+	}
+}
+
+static void encodeSeriesChunked(ChunkEncoder *enc, Fingerprinter *fingerprint, size_t series) {
+	QCBOREncodeContext *pCtx = &(enc->ctx);
+	size_t values = valuesOf(fingerprint, series);
+
+	encodeTargetCached(pCtx, fingerprint);
+	chunkFlush(enc);
+	encodeEnvParamsDirect(pCtx, fingerprint, series, sampleOf(fingerprint, series));
+	QCBOREncode_AddUInt64(pCtx, UNIT_ELECTRICAL_SI_NONE_c);//unit: Unit
+	QCBOREncode_AddInt64(pCtx, UNIT_MULTIPLE_SI_BASE_c);//unit-multiple: UnitMultiple
+	if (isPackedSeries(fingerprint, series)) {//the samples bypass the window
+		chunkAddRaw(enc, &CBOR_REGULAR_SERIES_HEAD);//measurements: RegularMeasurementSeries
+		encodePackedValuesChunked(enc, fingerprint, series);
+		encodeIntervalDirect(pCtx, fingerprint, series);
+		chunkFlush(enc);
+		return;
+	}
+	if (!isIrregularSeries(fingerprint, series)) {
+		chunkAddRaw(enc, &CBOR_REGULAR_SERIES_HEAD);//measurements: RegularMeasurementSeries
+		QCBOREncode_AddInt64(pCtx, values_map);
+	}
+	chunkAddRaw(enc, &CBOR_INDEFINITE_ARRAY);//values => [ * NumericalValue ] or IrregularMeasurementSeries
+	chunkFlush(enc);
+
+	for (size_t from = 0; from < values && enc->err == QCBOR_SUCCESS; from += CHUNK_VALUES_PER_WINDOW) {
+		size_t to = (values - from > CHUNK_VALUES_PER_WINDOW) ? from + CHUNK_VALUES_PER_WINDOW : values;
+		encodeValuesDirect(pCtx, fingerprint, series, from, to);
+		chunkFlush(enc);
+	}
+
+	chunkAddRaw(enc, &CBOR_BREAK);
+	if (!isIrregularSeries(fingerprint, series)) {
+		encodeIntervalDirect(pCtx, fingerprint, series);
+	}
+	chunkFlush(enc);
+}
+
+static void chunkBeginAnalogMeasurement(ChunkEncoder *enc) {//up to the open measurements array
+	QCBOREncode_Init(&(enc->ctx), enc->window);
+	chunkAddRaw(enc, &CBOR_ANALOG_MEASUREMENT_HEAD);//AnalogMeasurement
+	QCBOREncode_AddUInt64(&(enc->ctx), 1);//version-tag
+	struct Time start_time = {
+		.Time_seconds_choice = Time_seconds_uint_c,
+		.Time_seconds_uint = 0,
+		.Time_unit_mult = UNIT_MULTIPLE_SI_MILLI_c
 	};
-	for (size_t i=0; i<fingerprint->num_of_samples; i++) {
-		struct MeasurementSeries tmpMS = {
-			.MeasurementSeries_target = {
-				.Target_id = UsefulBuf_FROM_SZ_LITERAL(fingerprint->name),
-				.Target_config_params_present = true,
-				.Target_config_params = {
-					.Params_m_count = 4,
-					.Params_NameValuePair_m = {{
-						.NameValuePair_name = UsefulBuf_FROM_SZ_LITERAL("test_pin"),
-						.NameValuePair_value = {
-							.AnyType_union_choice = AnyType_int_c,
-							.AnyType_int = fingerprint->test_pin
-						}
-					}, {
-						.NameValuePair_name = UsefulBuf_FROM_SZ_LITERAL("test_pin_bank"),
-						.NameValuePair_value = {
-							.AnyType_union_choice = AnyType_int_c,
-							.AnyType_int = (unsigned long)fingerprint->test_pin_bank
-						}
-					}, {
-						.NameValuePair_name = UsefulBuf_FROM_SZ_LITERAL("op_pin"),
-						.NameValuePair_value = {
-							.AnyType_union_choice = AnyType_int_c,
-							.AnyType_int = fingerprint->op_pin
-						}
-					}, {
-						.NameValuePair_name = UsefulBuf_FROM_SZ_LITERAL("op_pin_bank"),
-						.NameValuePair_value = {
-							.AnyType_union_choice = AnyType_int_c,
-							.AnyType_int = (unsigned long)fingerprint->op_pin_bank
-						}
-					}}
-				}
-			},
-			.MeasurementSeries_env_params_present = false,
-			.MeasurementSeries_env_params = {//humidity, temperature, ...
-				.Params_m_count = 0,
-			},
-			.MeasurementSeries_start_time_present = false,
-			.MeasurementSeries_unit = {
-				.Unit_choice = Unit_UnitElectricalSi_m_c,
-				.Unit_UnitElectricalSi_m = UNIT_ELECTRICAL_SI_NONE_c
-			},
-			.MeasurementSeries_unit_multiple = UNIT_MULTIPLE_SI_BASE_c,
-			.MeasurementSeries_union_choice = MeasurementSeries_union_RegularMeasurementSeries_c,
-		};
-		struct RegularMeasurementSeries *tmpRegMS = &(tmpMS.MeasurementSeries_union_RegularMeasurements);
-		tmpRegMS->RegularMeasurementSeries_values_NumericalValue_m_count = fingerprint->sample_size;
-		for (size_t j=0; j<fingerprint->sample_size; j++) {
-			struct NumericalValue_value_r tmpNv = INIT_NUMERICAL_VALUE_INT(fingerprint->samples[j + (i * fingerprint->sample_size)]);
-			tmpRegMS->RegularMeasurementSeries_values_NumericalValue_m[j] = tmpNv;
+	encodeTime(&(enc->ctx), &start_time, false, 0, enc->huart);//start-time: Time
+	chunkAddRaw(enc, &CBOR_INDEFINITE_ARRAY);//measurements: [ * MeasurementSeries ]
+	chunkFlush(enc);
+}
+
+static void chunkEndAnalogMeasurement(ChunkEncoder *enc) {
+	chunkAddRaw(enc, &CBOR_BREAK);//measurements: [ * MeasurementSeries ]
+	chunkFlush(enc);
+}
+
+static void encodeChunked(ChunkEncoder *enc, Fingerprinter **fingerprints, size_t count) {
+	chunkBeginAnalogMeasurement(enc);
+	for (size_t f=0; f<count && enc->err == QCBOR_SUCCESS; f++) {
+		for (size_t i=0; i<seriesOf(fingerprints[f]) && enc->err == QCBOR_SUCCESS; i++) {
+			encodeSeriesChunked(enc, fingerprints[f], i);
 		}
-		tmpRegMS->RegularMeasurementSeries_interval_frequency_duration_m.interval_frequency_duration_choice = interval_frequency_duration_duration_c;
-		tmpRegMS->RegularMeasurementSeries_interval_frequency_duration_m.interval_frequency_duration_duration.Time_seconds_choice = Time_seconds_uint_c;
-		tmpRegMS->RegularMeasurementSeries_interval_frequency_duration_m.interval_frequency_duration_duration.Time_seconds_uint = fingerprint->delta_t[i];
-		tmpRegMS->RegularMeasurementSeries_interval_frequency_duration_m.interval_frequency_duration_duration.Time_unit_mult = UNIT_MULTIPLE_SI_MILLI_c;
-		tmp.AnalogMeasurement_measurements_MeasurementSeries_m[i] = tmpMS;
 	}
+	chunkEndAnalogMeasurement(enc);
+}
+
+size_t get_encoded_size_chunked(Fingerprinter **fingerprints, size_t count) {
+	ChunkEncoder enc = {
+		.window = SizeCalculateUsefulBuf,
+		.huart = fingerprints[0]->uart,
+		.count_only = true,
+		.sent = 0,
+		.err = QCBOR_SUCCESS,
+	};
+	encodeChunked(&enc, fingerprints, count);
+	return (enc.err == QCBOR_SUCCESS) ? enc.sent : 0;
+}
+
+QCBORError convert_to_cbor_chunked(Fingerprinter **fingerprints, size_t count, size_t *encoded_len) {
+	UsefulBuf_MAKE_STACK_UB(  Window, CHUNK_WINDOW_SIZE);
+	ChunkEncoder enc = {
+		.window = Window,
+		.huart = fingerprints[0]->uart,
+		.count_only = false,
+		.sent = 0,
+		.err = QCBOR_SUCCESS,
+	};
+	encodeChunked(&enc, fingerprints, count);
+	if (encoded_len != NULL) {
+		*encoded_len = enc.sent;
+	}
+	return enc.err;
+}
+
+static uint8_t stream_window[CHUNK_WINDOW_SIZE];
+static ChunkEncoder stream_encoder;
+static Fingerprinter *stream_fingerprint = NULL;//stream whose series is open, NULL before the first block
 
-	UsefulBuf_MAKE_STACK_UB(  EngineBuffer, 350);//determine size using CALCULATE_BUF_SIZE
-	QCBORError err = encodeAnalogMeasurement(EngineBuffer, &tmp, buffer, fingerprint->uart);
-	HAL_UART_Transmit(fingerprint->uart, (uint8_t *) buffer->ptr, buffer->len, 100);
-	return err;
+static void encodeStreamHead(Fingerprinter *fingerprint) {//everything up to the first value, sent once per stream
+	ChunkEncoder *enc = &stream_encoder;
+	*enc = (ChunkEncoder){
+		.window = {stream_window, sizeof(stream_window)},
+		.huart = fingerprint->uart,
+		.count_only = false,
+		.sent = 0,
+		.err = QCBOR_SUCCESS,
+	};
+	stream_fingerprint = fingerprint;
+
+	chunkBeginAnalogMeasurement(enc);
+	encodeTargetCached(&(enc->ctx), fingerprint);
+	chunkFlush(enc);
+	encodeEnvParamsDirect(&(enc->ctx), fingerprint, 0, 0);//one discharge precedes the whole stream
+	QCBOREncode_AddUInt64(&(enc->ctx), UNIT_ELECTRICAL_SI_NONE_c);//unit: Unit
+	QCBOREncode_AddInt64(&(enc->ctx), UNIT_MULTIPLE_SI_BASE_c);//unit-multiple: UnitMultiple
+	chunkAddRaw(enc, &CBOR_REGULAR_SERIES_HEAD);//measurements: RegularMeasurementSeries
+	QCBOREncode_AddInt64(&(enc->ctx), values_map);
+	chunkAddRaw(enc, &CBOR_INDEFINITE_ARRAY);//values => [ * NumericalValue ]
+	chunkFlush(enc);
+}
+
+void convert_block_to_cbor(Fingerprinter *fingerprint, const uint16_t *block, size_t length, size_t block_index) {
+	ChunkEncoder *enc = &stream_encoder;
+	if (block_index == 0 || stream_fingerprint != fingerprint) {
+		encodeStreamHead(fingerprint);
+	}
+	//the blocks of one stream are contiguous, so they continue the same values array
+	for (size_t from = 0; from < length && enc->err == QCBOR_SUCCESS; from += CHUNK_VALUES_PER_WINDOW) {
+		size_t to = (length - from > CHUNK_VALUES_PER_WINDOW) ? from + CHUNK_VALUES_PER_WINDOW : length;
+		for (size_t j = from; j < to; j++) {
+			QCBOREncode_AddInt64(&(enc->ctx), block[j]);
+		}
+		chunkFlush(enc);
+	}
+}
+
+QCBORError convert_stream_end_to_cbor(Fingerprinter *fingerprint, size_t *encoded_len) {
+	ChunkEncoder *enc = &stream_encoder;
+	if (stream_fingerprint != fingerprint) {//no block arrived, the series stays empty
+		encodeStreamHead(fingerprint);
+	}
+	chunkAddRaw(enc, &CBOR_BREAK);//values => [ * NumericalValue ]
+	QCBOREncode_AddInt64(&(enc->ctx), interval_frequency_duration_frequency_c);
+	encodeFrequencyDirect(&(enc->ctx), fingerprint->trigger_rate_hz);//the trigger rate paces every block
+	chunkEndAnalogMeasurement(enc);
+	stream_fingerprint = NULL;
+
+	if (encoded_len != NULL) {
+		*encoded_len = enc->sent;
+	}
+	return enc->err;
 }
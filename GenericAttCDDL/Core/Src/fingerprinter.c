@@ -26,17 +26,93 @@
 
 #include "stm32l4xx_hal.h"
 #include "stm32l4xx_ll_system.h"
+#include "sampleKernels.h"
+#include "adcCalibration.h"
 
 
 #define SAMPLE_DIVIDER (4096)
 
 #define V_REF (3.3)
 
+// VREFINT needs at least 4 us of sampling, 92.5 cycles are 11.6 us at the 8 MHz capture ADC clock
+#define VREFINT_SAMPLING_TIME ADC_SAMPLETIME_92CYCLES_5
+
+// The temperature sensor needs at least 5 us of sampling
+#define TEMPSENSOR_SAMPLING_TIME ADC_SAMPLETIME_92CYCLES_5
+
+#define DMA_TIMEOUT_MS (100)
+
+// ADC counts a line has to fall below to count as discharged (about 13 mV)
+#define DEFAULT_SETTLE_THRESHOLD (16)
+
+// Upper bound of each discharge phase, the former fixed delay
+#define DEFAULT_SETTLE_TIMEOUT_MS (100)
+
+// Consecutive probes below the threshold before a line counts as settled
+#define SETTLE_CONSECUTIVE_PROBES (3)
+
+// 1 - 1/e in Q16, the share of its swing an RC curve covers after one time constant
+#define RC_TAU_FRACTION_Q16 (41427)
+
+// Conversions the early slope is taken over
+#define RC_EARLY_SLOPE_SAMPLES (4)
+
 typedef enum {
 	IN,
 	OUT,
 } GPIOMode;
 
+typedef struct {
+	const char * name;
+	unsigned int ratio;
+	uint32_t oversampling_ratio;
+	uint32_t right_bit_shift;
+	uint32_t sampling_time;
+	unsigned int conversion_half_cycles;	// ADC clock half cycles of one conversion, sampling plus 12.5 for 12 bit
+} AcquisitionProfileConfig;
+
+// The shift brings every averaged profile back to 12 bit, so all profiles share one scale
+static const AcquisitionProfileConfig acquisition_profiles[] = {
+	[ACQUISITION_FAST] = {"fast", 1, 0, ADC_RIGHTBITSHIFT_NONE, ADC_SAMPLETIME_2CYCLES_5, 30},
+	[ACQUISITION_OVS_4] = {"ovs4", 4, ADC_OVERSAMPLING_RATIO_4, ADC_RIGHTBITSHIFT_2, ADC_SAMPLETIME_2CYCLES_5, 30},
+	[ACQUISITION_OVS_16] = {"ovs16", 16, ADC_OVERSAMPLING_RATIO_16, ADC_RIGHTBITSHIFT_4, ADC_SAMPLETIME_2CYCLES_5, 30},
+	[ACQUISITION_OVS_256] = {"ovs256", 256, ADC_OVERSAMPLING_RATIO_256, ADC_RIGHTBITSHIFT_8, ADC_SAMPLETIME_2CYCLES_5, 30},
+};
+
+#define NUM_OF_ACQUISITION_PROFILES (sizeof(acquisition_profiles) / sizeof(acquisition_profiles[0]))
+
+static const uint32_t regular_ranks[MAX_SCAN_CHANNELS] = {
+	ADC_REGULAR_RANK_1, ADC_REGULAR_RANK_2, ADC_REGULAR_RANK_3,
+};
+
+// One rank per scanned line, followed by VREFINT
+static const uint32_t injected_ranks[MAX_SCAN_CHANNELS + 1] = {
+	ADC_INJECTED_RANK_1, ADC_INJECTED_RANK_2, ADC_INJECTED_RANK_3, ADC_INJECTED_RANK_4,
+};
+
+// Backing store of all fingerprinter buffers, handed out by arena_alloc and never freed
+// individually. Word alignment keeps every buffer usable as a DMA destination.
+static uint32_t arena[FINGERPRINTER_ARENA_SIZE / sizeof(uint32_t)];
+static size_t arena_used = 0;
+
+// Fingerprinter whose DMA capture is currently in flight
+static Fingerprinter * active_capture = NULL;
+
+// Fingerprinter streaming through the circular DMA ring buffer, see get_fingerprint_stream
+static Fingerprinter * volatile stream_fingerprint = NULL;
+
+// Ring buffer halves written by DMA but not yet handed to the stream callback, one byte
+// each so thread and interrupt never share a read-modify-write
+static volatile uint8_t stream_pending[2];
+static volatile uint8_t stream_overrun = 0;
+
+// Fingerprinter advanced by poll_fingerprint_async, see start_fingerprint_async
+static Fingerprinter * volatile async_fingerprint = NULL;
+
+// Set by fingerprinter_tick, so the settle probes keep a pace of one per SysTick
+// however often the thread polls
+static volatile uint8_t async_tick_pending = 0;
+
 void print_string(void * uart, char const * string) {
 	if (uart != NULL && string != NULL) {
 		HAL_UART_Transmit(uart, (uint8_t *) string,
@@ -45,6 +121,27 @@ void print_string(void * uart, char const * string) {
 	}
 }
 
+static void * arena_alloc(size_t size) {
+	size_t words = (size + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+	if (words > sizeof(arena) / sizeof(uint32_t) - arena_used) {
+		return NULL;
+	}
+	void * buffer = &arena[arena_used];
+	arena_used += words;
+	return buffer;
+}
+
+// Gives a scratch buffer back by rewinding to mark, the arena_used seen right before it was
+// allocated. Anything allocated behind it since scratch_end would be handed out twice, so
+// the scratch buffer is kept instead.
+static void arena_release(size_t mark, size_t scratch_end, void * uart) {
+	if (arena_used != scratch_end) {
+		print_string(uart, "[ERROR] arena allocation during capture, scratch buffer kept\r\n");
+		return;
+	}
+	arena_used = mark;
+}
+
 static void set_gpio_mode (GPIO_TypeDef * pin_bank,
 		unsigned int pin, GPIOMode mode) {
 	GPIO_InitTypeDef GPIO_InitStruct = {0};
@@ -65,6 +162,34 @@ static void set_gpio_mode (GPIO_TypeDef * pin_bank,
 	HAL_GPIO_Init(pin_bank, &GPIO_InitStruct);
 }
 
+static void compute_gpio_masks(unsigned int pin, GpioMasks * masks) {
+	masks->pin_mask = pin;
+	masks->field_mask = 0;
+	masks->output_bits = 0;
+	for (unsigned int position = 0; position < 16; position++) {
+		if (pin & (1U << position)) {
+			masks->field_mask |= GPIO_MODER_MODE0 << (position * 2);
+			masks->output_bits |= GPIO_MODER_MODE0_0 << (position * 2);
+		}
+	}
+}
+
+// Same configuration as set_gpio_mode, but without walking the pins in HAL_GPIO_Init,
+// so the switches at the start of the discharge and at the release of the operation
+// pin take a fixed number of cycles within the timed settle phases
+static void set_gpio_mode_fast(GPIO_TypeDef * pin_bank, const GpioMasks * masks,
+		GPIOMode mode) {
+	uint32_t moder = pin_bank->MODER & ~masks->field_mask;
+
+	if (mode == OUT) {
+		pin_bank->OTYPER &= ~masks->pin_mask;	// push-pull
+		pin_bank->OSPEEDR &= ~masks->field_mask;	// low speed
+		moder |= masks->output_bits;
+	}
+	pin_bank->PUPDR &= ~masks->field_mask;	// no pull
+	pin_bank->MODER = moder;
+}
+
 static void print_samples(Fingerprinter * fingerprint, size_t sample_number) {
 	print_string(fingerprint->uart, "--- Sensor: ");
 	print_string(fingerprint->uart, fingerprint->name);
@@ -76,17 +201,322 @@ static void print_samples(Fingerprinter * fingerprint, size_t sample_number) {
 	print_string(fingerprint->uart, delta_t_buff);
 	print_string(fingerprint->uart, "\r\n");
 
+	print_string(fingerprint->uart, "Settle T: ");
+	snprintf(delta_t_buff, 20, "%lu us", get_settle_us(fingerprint, sample_number));
+	print_string(fingerprint->uart, delta_t_buff);
+	print_string(fingerprint->uart, fingerprint->settle_timed_out[sample_number] ?
+			" (timed out)\r\n" : "\r\n");
+
+	// Raw samples are ratiometric to VDDA, corrected ones to V_REF
+	unsigned long vdda_mv = get_vdda_mv(fingerprint, sample_number);
+	double v_ref = (fingerprint->supply_correction || vdda_mv == 0) ? V_REF : vdda_mv / 1000.0;
 	for (size_t i = 0; i < fingerprint->sample_size; i++){
 		double val = (double)((double)fingerprint->samples[i + (sample_number * fingerprint->sample_size)] /
-				(double)(SAMPLE_DIVIDER) * V_REF);
+				(double)(SAMPLE_DIVIDER) * v_ref);
 		snprintf(delta_t_buff, 20, "%1.2f", val);
 		print_string(fingerprint->uart, delta_t_buff);
 		print_string(fingerprint->uart, "\r\n");
 	}
 }
 
-static void measure(Fingerprinter * fingerprint, size_t sample_number) {
+static uint32_t get_trigger_source(TIM_TypeDef * instance) {
+	if (instance == TIM1) {
+		return ADC_EXTERNALTRIG_T1_TRGO;
+	} else if (instance == TIM2) {
+		return ADC_EXTERNALTRIG_T2_TRGO;
+	} else if (instance == TIM6) {
+		return ADC_EXTERNALTRIG_T6_TRGO;
+	} else if (instance == TIM15) {
+		return ADC_EXTERNALTRIG_T15_TRGO;
+	}
+	return ADC_SOFTWARE_START;
+}
+
+static uint32_t get_timer_clock(TIM_TypeDef * instance) {
+	RCC_ClkInitTypeDef clk_config;
+	uint32_t flash_latency;
+	HAL_RCC_GetClockConfig(&clk_config, &flash_latency);
+
+	// Timers run at twice the APB clock whenever the APB prescaler is not 1
+	if (instance == TIM1 || instance == TIM15 || instance == TIM16) {
+		uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+		return (clk_config.APB2CLKDivider == RCC_HCLK_DIV1) ? pclk : 2 * pclk;
+	}
+	uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+	return (clk_config.APB1CLKDivider == RCC_HCLK_DIV1) ? pclk : 2 * pclk;
+}
+
+static void configure_trigger_timer(Fingerprinter * fingerprint) {
+	TIM_HandleTypeDef * trigger = (TIM_HandleTypeDef *) fingerprint->trigger_timer;
+	uint32_t timer_clock = get_timer_clock(trigger->Instance);
+	uint32_t max_period = IS_TIM_32B_COUNTER_INSTANCE(trigger->Instance) ?
+			0xFFFFFFFF : 0xFFFF;
+	uint32_t ticks = timer_clock / fingerprint->sample_rate_hz;
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	uint32_t prescaler = ticks / max_period + 1;
+	uint32_t period = ticks / prescaler;
+
+	HAL_TIM_Base_Stop(trigger);
+	trigger->Init.Prescaler = prescaler - 1;
+	trigger->Init.Period = period - 1;
+	__HAL_TIM_SET_PRESCALER(trigger, prescaler - 1);
+	__HAL_TIM_SET_AUTORELOAD(trigger, period - 1);
+	// Load the prescaler now, the ADC is not started yet and ignores the TRGO
+	trigger->Instance->EGR = TIM_EGR_UG;
+	__HAL_TIM_SET_COUNTER(trigger, 0);
+
+	// Rate actually achieved after integer division of the timer clock
+	fingerprint->trigger_rate_hz = (double) timer_clock /
+			((double) prescaler * (double) period);
+}
+
+static uint32_t get_adc_clock(ADC_HandleTypeDef * adc) {
+	// The synchronous clock modes divide HCLK, the asynchronous ones are not checked
+	switch (adc->Init.ClockPrescaler) {
+	case ADC_CLOCK_SYNC_PCLK_DIV1:
+		return HAL_RCC_GetHCLKFreq();
+	case ADC_CLOCK_SYNC_PCLK_DIV2:
+		return HAL_RCC_GetHCLKFreq() / 2;
+	case ADC_CLOCK_SYNC_PCLK_DIV4:
+		return HAL_RCC_GetHCLKFreq() / 4;
+	default:
+		return 0;
+	}
+}
+
+static int trigger_period_fits(Fingerprinter * fingerprint, AcquisitionProfile profile,
+		unsigned long sample_rate_hz, size_t channels) {
+	// Every trigger converts each channel ratio times, a trigger arriving while
+	// the ADC still converts is dropped without notice
+	uint32_t adc_clock = get_adc_clock((ADC_HandleTypeDef *) fingerprint->adc);
+	uint64_t half_cycles = (uint64_t) channels * acquisition_profiles[profile].ratio *
+			acquisition_profiles[profile].conversion_half_cycles;
+	if (adc_clock == 0 || half_cycles * sample_rate_hz <= 2 * (uint64_t) adc_clock) {
+		return 1;
+	}
+	print_string(fingerprint->uart, "[ERROR] trigger rate too high for the acquisition profile\r\n");
+	return 0;
+}
+
+static void configure_adc(Fingerprinter ** fingerprints, size_t count) {
+	// The first fingerprinter of a scan decides on mode and profile for all of them
+	Fingerprinter * fingerprint = fingerprints[0];
+	ADC_HandleTypeDef * adc = (ADC_HandleTypeDef *) fingerprint->adc;
+	const AcquisitionProfileConfig * profile =
+			&acquisition_profiles[fingerprint->acquisition_profile];
+
+	// Captures only start from here, so the ADC is idle if the calibration is due
+	maintain_adc_calibration(adc);
+
+	// DMA captures let the ADC convert back to back, polled ones are started one by one.
+	// A scan over several channels always needs DMA.
+	adc->Init.ContinuousConvMode =
+			(fingerprint->capture_mode == CAPTURE_DMA ||
+			(count > 1 && fingerprint->capture_mode == CAPTURE_POLLED)) ? ENABLE : DISABLE;
+	// Only a streaming capture keeps requesting DMA transfers after the buffer wrapped
+	adc->Init.DMAContinuousRequests = (stream_fingerprint == fingerprint) ? ENABLE : DISABLE;
+	adc->Init.ScanConvMode = (count > 1) ? ADC_SCAN_ENABLE : ADC_SCAN_DISABLE;
+	adc->Init.NbrOfConversion = count;
+	if (fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED) {
+		// Every trigger converts the whole scan sequence, which the setters could not
+		// check for scans or for a different capture clock
+		trigger_period_fits(fingerprint, fingerprint->acquisition_profile,
+				fingerprint->sample_rate_hz, count);
+		configure_trigger_timer(fingerprint);
+		adc->Init.ExternalTrigConv = get_trigger_source(
+				((TIM_HandleTypeDef *) fingerprint->trigger_timer)->Instance);
+		adc->Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+	} else {
+		adc->Init.ExternalTrigConv = ADC_SOFTWARE_START;
+		adc->Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+	}
+
+	// Oversampling averages in hardware, one trigger runs all conversions of a sample
+	if (profile->ratio > 1) {
+		adc->Init.OversamplingMode = ENABLE;
+		adc->Init.Oversampling.Ratio = profile->oversampling_ratio;
+		adc->Init.Oversampling.RightBitShift = profile->right_bit_shift;
+		adc->Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+		adc->Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+	} else {
+		adc->Init.OversamplingMode = DISABLE;
+	}
+	if (HAL_ADC_Init(adc) != HAL_OK) {
+		print_string(fingerprint->uart, "[ERROR] ADC configuration failed\r\n");
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		ADC_ChannelConfTypeDef channel_config = {0};
+		channel_config.Channel = fingerprints[i]->adc_channel;
+		channel_config.Rank = regular_ranks[i];
+		channel_config.SamplingTime = profile->sampling_time;
+		channel_config.SingleDiff = ADC_SINGLE_ENDED;
+		channel_config.OffsetNumber = ADC_OFFSET_NONE;
+		channel_config.Offset = 0;
+		if (HAL_ADC_ConfigChannel(adc, &channel_config) != HAL_OK) {
+			print_string(fingerprint->uart, "[ERROR] ADC channel configuration failed\r\n");
+		}
+
+		// The injected group probes the same channels while the lines settle
+		ADC_InjectionConfTypeDef injection_config = {0};
+		injection_config.InjectedChannel = fingerprints[i]->adc_channel;
+		injection_config.InjectedRank = injected_ranks[i];
+		injection_config.InjectedSamplingTime = profile->sampling_time;
+		injection_config.InjectedSingleDiff = ADC_SINGLE_ENDED;
+		injection_config.InjectedOffsetNumber = ADC_OFFSET_NONE;
+		injection_config.InjectedOffset = 0;
+		injection_config.InjectedNbrOfConversion = count + 1;
+		injection_config.InjectedDiscontinuousConvMode = DISABLE;
+		injection_config.AutoInjectedConv = DISABLE;
+		injection_config.QueueInjectedContext = DISABLE;
+		injection_config.ExternalTrigInjecConv = ADC_INJECTED_SOFTWARE_START;
+		injection_config.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONV_EDGE_NONE;
+		injection_config.InjecOversamplingMode = DISABLE;
+		if (HAL_ADCEx_InjectedConfigChannel(adc, &injection_config) != HAL_OK) {
+			print_string(fingerprint->uart, "[ERROR] ADC injected channel configuration failed\r\n");
+		}
+	}
+
+	// Every settle probe also samples VREFINT, so each capture knows its supply voltage
+	ADC_InjectionConfTypeDef vrefint_config = {0};
+	vrefint_config.InjectedChannel = ADC_CHANNEL_VREFINT;
+	vrefint_config.InjectedRank = injected_ranks[count];
+	vrefint_config.InjectedSamplingTime = VREFINT_SAMPLING_TIME;
+	vrefint_config.InjectedSingleDiff = ADC_SINGLE_ENDED;
+	vrefint_config.InjectedOffsetNumber = ADC_OFFSET_NONE;
+	vrefint_config.InjectedOffset = 0;
+	vrefint_config.InjectedNbrOfConversion = count + 1;
+	vrefint_config.InjectedDiscontinuousConvMode = DISABLE;
+	vrefint_config.AutoInjectedConv = DISABLE;
+	vrefint_config.QueueInjectedContext = DISABLE;
+	vrefint_config.ExternalTrigInjecConv = ADC_INJECTED_SOFTWARE_START;
+	vrefint_config.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONV_EDGE_NONE;
+	vrefint_config.InjecOversamplingMode = DISABLE;
+	if (HAL_ADCEx_InjectedConfigChannel(adc, &vrefint_config) != HAL_OK) {
+		print_string(fingerprint->uart, "[ERROR] ADC VREFINT configuration failed\r\n");
+	}
+
+	// The temperature sensor is converted on its own after each capture, see measure_environment.
+	// Its path can only be switched while the ADC is disabled and starts up during the discharge.
+	if (!LL_ADC_IsEnabled(adc->Instance)) {
+		LL_ADC_SetCommonPathInternalChAdd(__LL_ADC_COMMON_INSTANCE(adc->Instance),
+				LL_ADC_PATH_INTERNAL_TEMPSENSOR);
+	}
+	LL_ADC_SetChannelSamplingTime(adc->Instance, ADC_CHANNEL_TEMPSENSOR, TEMPSENSOR_SAMPLING_TIME);
+}
+
+static void measure_polled(Fingerprinter * fingerprint, uint16_t * samples) {
+	for (size_t i = 0; i < fingerprint->sample_size; i++){
+		HAL_ADC_Start(fingerprint->adc);
+		while (HAL_ADC_PollForConversion(fingerprint->adc,
+				1000000) != HAL_OK);
+		HAL_ADC_Stop(fingerprint->adc);
+		samples[i] = (uint16_t) HAL_ADC_GetValue(fingerprint->adc);
+	}
+}
+
+static uint32_t get_capture_timeout(Fingerprinter * fingerprint) {
+	uint32_t timeout = DMA_TIMEOUT_MS;
+	if (fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED) {
+		timeout += (fingerprint->sample_size * 1000UL) / fingerprint->sample_rate_hz;
+	}
+	return timeout;
+}
+
+static int start_dma_capture(Fingerprinter * fingerprint, uint16_t * samples, size_t length) {
+	TIM_HandleTypeDef * trigger = (TIM_HandleTypeDef *) fingerprint->trigger_timer;
+
+	fingerprint->capture_done = 0;
+	active_capture = fingerprint;
+	if (HAL_ADC_Start_DMA(fingerprint->adc, (uint32_t *) samples,
+			length) != HAL_OK) {
+		active_capture = NULL;
+		print_string(fingerprint->uart, "[ERROR] ADC DMA start failed\r\n");
+		return -1;
+	}
+
+	if (fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED) {
+		// The first TRGO update event starts the first conversion
+		__HAL_TIM_SET_COUNTER(trigger, 0);
+		HAL_TIM_Base_Start(trigger);
+	}
+	return 0;
+}
+
+static void stop_dma_capture(Fingerprinter * fingerprint) {
+	if (fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED) {
+		HAL_TIM_Base_Stop((TIM_HandleTypeDef *) fingerprint->trigger_timer);
+	}
+	HAL_ADC_Stop_DMA(fingerprint->adc);
+	active_capture = NULL;
+}
+
+static void measure_dma(Fingerprinter * fingerprint, uint16_t * samples, size_t length) {
+	if (start_dma_capture(fingerprint, samples, length) != 0) {
+		return;
+	}
+
+	// Completion is signalled by HAL_ADC_ConvCpltCallback
+	uint32_t timeout = get_capture_timeout(fingerprint);
+	uint32_t start_tick = HAL_GetTick();
+	while (!fingerprint->capture_done) {
+		if (HAL_GetTick() - start_tick > timeout) {
+			print_string(fingerprint->uart, "[ERROR] ADC DMA capture timed out\r\n");
+			break;
+		}
+	}
+	stop_dma_capture(fingerprint);
+}
+
+static void enable_cycle_counter(void) {
+	if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CYCCNT = 0;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	}
+}
+
+static void mark_phase(Fingerprinter ** fingerprints, size_t count, size_t sample_number,
+		TimingPhase phase) {
+	unsigned long now = DWT->CYCCNT;
+	for (size_t i = 0; i < count; i++) {
+		if (fingerprints[i]->phase_timing) {
+			fingerprints[i]->phase_t[sample_number * NUM_OF_PHASE_MARKS + phase] = now;
+			fingerprints[i]->cycle_clock_hz = SystemCoreClock;
+		}
+	}
+}
+
+static unsigned long read_timing(Fingerprinter * fingerprint) {
+	if (fingerprint->timing_backend == TIMING_DWT) {
+		return DWT->CYCCNT;
+	}
+	return __HAL_TIM_GET_COUNTER((TIM_HandleTypeDef *) fingerprint->timer);
+}
+
+// Ticks from one reading to a later one, the timer counter wraps at its autoreload value
+static unsigned long timing_elapsed(Fingerprinter * fingerprint, unsigned long from,
+		unsigned long to) {
+	if (fingerprint->timing_backend == TIMING_DWT) {
+		return (uint32_t) (to - from);
+	}
+	unsigned long period = __HAL_TIM_GET_AUTORELOAD((TIM_HandleTypeDef *) fingerprint->timer) + 1;
+	return (to >= from) ? to - from : to + period - from;
+}
+
+static unsigned long start_timing(Fingerprinter * fingerprint) {
+	// Timing based features are only comparable between captures at the same clock
+	fingerprint->capture_clock_hz = SystemCoreClock;
+
 	// Measure the start time
+	if (fingerprint->timing_backend == TIMING_DWT) {
+		// The cycle counter runs at HCLK and wraps only after 2^32 cycles
+		fingerprint->delta_t_hz = SystemCoreClock;
+		return read_timing(fingerprint);
+	}
+
 	TIM_HandleTypeDef * timer = (TIM_HandleTypeDef *)
 			fingerprint->timer;
 
@@ -94,21 +524,304 @@ static void measure(Fingerprinter * fingerprint, size_t sample_number) {
 	__HAL_TIM_SET_COUNTER(timer, 0);
 	HAL_TIM_Base_Start(timer);
 
-	unsigned long start_micros =
-			__HAL_TIM_GET_COUNTER(timer);
+	fingerprint->delta_t_hz = get_timer_clock(timer->Instance) / (timer->Instance->PSC + 1);
+	return read_timing(fingerprint);
+}
 
-	// Do the measurement
+static uint64_t get_sample_period_ns(Fingerprinter * fingerprint, unsigned long delta_t) {
+	if (fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED && fingerprint->trigger_rate_hz > 0) {
+		return (uint64_t) (1e9 / fingerprint->trigger_rate_hz + 0.5);
+	}
+	// Otherwise the conversions are assumed to spread evenly over delta_t
+	if (fingerprint->delta_t_hz == 0 || fingerprint->sample_size == 0) {
+		return 0;
+	}
+	return ((uint64_t) delta_t * 1000000000ULL) /
+			((uint64_t) fingerprint->delta_t_hz * fingerprint->sample_size);
+}
+
+static int32_t fit_asymptote(const uint16_t * y, size_t n) {
+	// Three equidistant points of y = A + B * r^k determine A exactly
+	if (n >= 3) {
+		size_t m = (n - 1) / 2;
+		int64_t ya = y[0], yb = y[m], yc = y[2 * m];
+		int64_t denominator = ya + yc - 2 * yb;
+		if (denominator != 0) {
+			int64_t asymptote = (ya * yc - yb * yb) / denominator;
+			if (asymptote >= 0 && asymptote <= 0xFFFF) {
+				return (int32_t) asymptote;
+			}
+		}
+	}
+
+	// Linear or noisy curves, fall back to the mean of the last quarter
+	size_t tail = (n + 3) / 4;
+	return (int32_t) (kernel_sum_u16(&y[n - tail], tail) / tail);
+}
+
+static void extract_rc_features(Fingerprinter * fingerprint, size_t sample_number,
+		uint64_t period_ns) {
+	const uint16_t * y = &fingerprint->samples[sample_number * fingerprint->sample_size];
+	int32_t * features = &fingerprint->rc_features[sample_number * NUM_OF_RC_FEATURES];
+	size_t n = fingerprint->sample_size;
+	if (n == 0) {
+		return;
+	}
+
+	int32_t offset = y[0];
+	int32_t asymptote = fit_asymptote(y, n);
+	int32_t swing = asymptote - offset;
+
+	// Time constant from the interpolated 63 % crossing, in Q8 sample periods
+	int64_t tau_q8 = 0;
+	int32_t target = offset + (int32_t) (((int64_t) swing * RC_TAU_FRACTION_Q16) >> 16);
+	for (size_t k = 1; k < n && swing != 0; k++) {
+		int32_t previous = y[k - 1], current = y[k];
+		if ((swing > 0 && current >= target) || (swing < 0 && current <= target)) {
+			int32_t step = current - previous;
+			int64_t fraction_q8 = (step != 0) ? (((int64_t) (target - previous)) << 8) / step : 0;
+			tau_q8 = (((int64_t) k - 1) << 8) + fraction_q8;
+			break;
+		}
+	}
+
+	size_t early = (n - 1 < RC_EARLY_SLOPE_SAMPLES) ? n - 1 : RC_EARLY_SLOPE_SAMPLES;
+	int64_t early_slope = 0;
+	if (early > 0 && period_ns > 0) {
+		early_slope = ((int64_t) y[early] - y[0]) * 1000000 / (int64_t) (early * period_ns);
+	}
+
+	features[RC_ASYMPTOTE] = asymptote;
+	features[RC_OFFSET] = offset;
+	features[RC_TAU_NS] = (int32_t) ((tau_q8 * (int64_t) period_ns) >> 8);
+	features[RC_EARLY_SLOPE] = (int32_t) early_slope;
+}
+
+static void measure_environment(Fingerprinter ** fingerprints, size_t count,
+		size_t sample_number) {
+	ADC_HandleTypeDef * adc = (ADC_HandleTypeDef *) fingerprints[0]->adc;
+	uint16_t ts_data = 0;
+
+	// Borrow the injected sequence for a single temperature conversion, then put the
+	// settle probes back. The capture is over, so the extra conversion costs it nothing.
+	uint32_t jsqr = adc->Instance->JSQR;
+	LL_ADC_INJ_SetSequencerLength(adc->Instance, LL_ADC_INJ_SEQ_SCAN_DISABLE);
+	LL_ADC_INJ_SetSequencerRanks(adc->Instance, LL_ADC_INJ_RANK_1, ADC_CHANNEL_TEMPSENSOR);
+	HAL_ADCEx_InjectedStart(adc);
+	if (HAL_ADCEx_InjectedPollForConversion(adc, 10) == HAL_OK) {
+		ts_data = (uint16_t) HAL_ADCEx_InjectedGetValue(adc, ADC_INJECTED_RANK_1);
+	}
+	HAL_ADCEx_InjectedStop(adc);
+	adc->Instance->JSQR = jsqr;
+
+	for (size_t i = 0; i < count; i++) {
+		fingerprints[i]->ts_data[sample_number] = ts_data;
+	}
+}
+
+static void correct_supply(Fingerprinter * fingerprint, size_t sample_number) {
+	unsigned long vdda_mv = get_vdda_mv(fingerprint, sample_number);
+	if (vdda_mv == 0) {
+		return;
+	}
+
+	// Scale the counts from the measured VDDA to the nominal V_REF
+	uint16_t * samples = &fingerprint->samples[sample_number * fingerprint->sample_size];
+	for (size_t i = 0; i < fingerprint->sample_size; i++) {
+		unsigned long corrected = (samples[i] * vdda_mv + V_REF_MV / 2) / V_REF_MV;
+		samples[i] = (uint16_t) (corrected < SAMPLE_DIVIDER ? corrected : SAMPLE_DIVIDER - 1);
+	}
+}
+
+// counted_ticks were already extended in software up to the reading last_ticks
+static void finish_timing(Fingerprinter ** fingerprints, size_t count, size_t sample_number,
+		uint16_t * scan_buffer, unsigned long last_ticks, unsigned long counted_ticks) {
+	Fingerprinter * fingerprint = fingerprints[0];
+
+	// Measure the end time and compute the difference
+	unsigned long end_ticks = read_timing(fingerprint);
+	unsigned long delta_t = counted_ticks + timing_elapsed(fingerprint, last_ticks, end_ticks);
+	mark_phase(fingerprints, count, sample_number, PHASE_END);
+	measure_environment(fingerprints, count, sample_number);
+
+	// The scan sequence interleaves the channels, rank by rank
+	for (size_t channel = 0; channel < count; channel++) {
+		if (count > 1) {
+			uint16_t * channel_samples = &fingerprints[channel]->samples[
+					sample_number * fingerprint->sample_size];
+			for (size_t i = 0; i < fingerprint->sample_size; i++) {
+				channel_samples[i] = scan_buffer[i * count + channel];
+			}
+		}
+		fingerprints[channel]->delta_t[sample_number] = delta_t;
+		fingerprints[channel]->delta_t_hz = fingerprint->delta_t_hz;
+		fingerprints[channel]->capture_clock_hz = fingerprint->capture_clock_hz;
+		fingerprints[channel]->trigger_rate_hz = fingerprint->trigger_rate_hz;
+		if (fingerprints[channel]->supply_correction) {
+			correct_supply(fingerprints[channel], sample_number);
+		}
+	}
+
+	// Fit the curves right after the capture, while the next discharge is not yet running
+	uint64_t period_ns = get_sample_period_ns(fingerprint, delta_t);
+	for (size_t channel = 0; channel < count; channel++) {
+		if (fingerprints[channel]->rc_feature_mode != RC_FEATURES_OFF) {
+			extract_rc_features(fingerprints[channel], sample_number, period_ns);
+		}
+	}
+}
+
+// Returns the ticks since capture start up to the reading left in last_ticks
+static unsigned long measure_timestamped(Fingerprinter * fingerprint, uint16_t * samples,
+		unsigned long * sample_t, unsigned long * last_ticks) {
+	// Extend the counter in software, it may wrap several times during a long capture
+	unsigned long last = *last_ticks;
+	unsigned long elapsed = 0;
 	for (size_t i = 0; i < fingerprint->sample_size; i++){
 		HAL_ADC_Start(fingerprint->adc);
 		while (HAL_ADC_PollForConversion(fingerprint->adc,
 				1000000) != HAL_OK);
+		// Read the counter right at EOC, before stopping the ADC
+		unsigned long now = read_timing(fingerprint);
+		elapsed += timing_elapsed(fingerprint, last, now);
+		last = now;
+		sample_t[i] = elapsed;
 		HAL_ADC_Stop(fingerprint->adc);
-		fingerprint->samples[i + (sample_number * fingerprint->sample_size)] = HAL_ADC_GetValue(fingerprint->adc);
+		samples[i] = (uint16_t) HAL_ADC_GetValue(fingerprint->adc);
 	}
+	*last_ticks = last;
+	return elapsed;
+}
 
-	// Measure the end time and compute the difference
-	unsigned long end_micros =  __HAL_TIM_GET_COUNTER(timer);
-	fingerprint->delta_t[sample_number] = end_micros - start_micros;
+static void measure(Fingerprinter ** fingerprints, size_t count, size_t sample_number,
+		uint16_t * scan_buffer) {
+	Fingerprinter * fingerprint = fingerprints[0];
+	uint16_t * samples = &fingerprint->samples[sample_number * fingerprint->sample_size];
+
+	unsigned long last_ticks = start_timing(fingerprint);
+	unsigned long counted_ticks = 0;
+	mark_phase(fingerprints, count, sample_number, PHASE_CAPTURE);
+
+	// Do the measurement
+	if (count > 1) {
+		measure_dma(fingerprint, scan_buffer, count * fingerprint->sample_size);
+	} else {
+		switch (fingerprint->capture_mode) {
+		case CAPTURE_DMA:
+		case CAPTURE_TIMER_TRIGGERED:
+			measure_dma(fingerprint, samples, fingerprint->sample_size);
+			break;
+		case CAPTURE_TIMESTAMPED:
+			counted_ticks = measure_timestamped(fingerprint, samples,
+					&fingerprint->sample_t[sample_number * fingerprint->sample_size], &last_ticks);
+			break;
+		case CAPTURE_POLLED:
+		default:
+			measure_polled(fingerprint, samples);
+			break;
+		}
+	}
+
+	finish_timing(fingerprints, count, sample_number, scan_buffer, last_ticks, counted_ticks);
+}
+
+static unsigned long elapsed_ticks(TIM_HandleTypeDef * timer, unsigned long * last) {
+	unsigned long now = __HAL_TIM_GET_COUNTER(timer);
+	unsigned long period = __HAL_TIM_GET_AUTORELOAD(timer) + 1;
+	unsigned long elapsed = (now >= *last) ? now - *last : now + period - *last;
+	*last = now;
+	return elapsed;
+}
+
+// Bit i is set if line i is below its threshold, no bit is set if the probe failed
+static unsigned int probe_lines(Fingerprinter ** fingerprints, size_t count, uint16_t * vrefint) {
+	ADC_HandleTypeDef * adc = (ADC_HandleTypeDef *) fingerprints[0]->adc;
+	unsigned int settled = 0;
+
+	HAL_ADCEx_InjectedStart(adc);
+	if (HAL_ADCEx_InjectedPollForConversion(adc, 10) == HAL_OK) {
+		*vrefint = (uint16_t) HAL_ADCEx_InjectedGetValue(adc, injected_ranks[count]);
+		for (size_t i = 0; i < count; i++) {
+			if (HAL_ADCEx_InjectedGetValue(adc, injected_ranks[i]) <=
+					fingerprints[i]->settle_threshold) {
+				settled |= 1U << i;
+			}
+		}
+	}
+	HAL_ADCEx_InjectedStop(adc);
+	return settled;
+}
+
+static int probe_settled(Fingerprinter ** fingerprints, size_t count, uint16_t * vrefint) {
+	return probe_lines(fingerprints, count, vrefint) == (1U << count) - 1;
+}
+
+// Adds the timer ticks spent to settle_ticks, returns -1 if settle_timeout_ms ran out first
+static int wait_settled(Fingerprinter ** fingerprints, size_t count, uint16_t * vrefint,
+		unsigned long * settle_ticks) {
+	TIM_HandleTypeDef * timer = (TIM_HandleTypeDef *) fingerprints[0]->timer;
+	unsigned int consecutive = 0;
+	unsigned long last = __HAL_TIM_GET_COUNTER(timer);
+	uint32_t start_tick = HAL_GetTick();
+
+	// Probe all lines until each one stayed below its threshold a few times in a row
+	while (consecutive < SETTLE_CONSECUTIVE_PROBES &&
+			HAL_GetTick() - start_tick < fingerprints[0]->settle_timeout_ms) {
+		consecutive = probe_settled(fingerprints, count, vrefint) ? consecutive + 1 : 0;
+		*settle_ticks += elapsed_ticks(timer, &last);
+	}
+	return (consecutive < SETTLE_CONSECUTIVE_PROBES) ? -1 : 0;
+}
+
+static void draw_low(Fingerprinter ** fingerprints, size_t count) {
+	// The microsecond timer keeps running between captures to time the settling
+	TIM_HandleTypeDef * timer = (TIM_HandleTypeDef *) fingerprints[0]->timer;
+	HAL_TIM_Base_Start(timer);
+	for (size_t i = 0; i < count; i++) {
+		fingerprints[i]->settle_t_hz = get_timer_clock(timer->Instance) / (timer->Instance->PSC + 1);
+	}
+
+	// Draw the lines low
+	for (size_t i = 0; i < count; i++) {
+		set_gpio_mode_fast(fingerprints[i]->op_pin_bank, &fingerprints[i]->op_pin_masks, OUT);
+		set_gpio_mode_fast(fingerprints[i]->test_pin_bank, &fingerprints[i]->test_pin_masks, OUT);
+		HAL_GPIO_WritePin(fingerprints[i]->op_pin_bank, fingerprints[i]->op_pin,
+				GPIO_PIN_RESET);
+		HAL_GPIO_WritePin(fingerprints[i]->test_pin_bank, fingerprints[i]->test_pin,
+				GPIO_PIN_RESET);
+	}
+}
+
+static void release_op_pins(Fingerprinter ** fingerprints, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		set_gpio_mode_fast(fingerprints[i]->op_pin_bank, &fingerprints[i]->op_pin_masks, IN);
+	}
+}
+
+static void discharge(Fingerprinter ** fingerprints, size_t count, size_t sample_number) {
+	mark_phase(fingerprints, count, sample_number, PHASE_DISCHARGE);
+	draw_low(fingerprints, count);
+	uint16_t vrefint = 0;
+	unsigned long settle_t = 0;
+	int timed_out = wait_settled(fingerprints, count, &vrefint, &settle_t) != 0;
+
+	// The last probe right before charging tells the supply voltage of the capture
+	release_op_pins(fingerprints, count);
+	timed_out |= wait_settled(fingerprints, count, &vrefint, &settle_t) != 0;
+
+	for (size_t i = 0; i < count; i++) {
+		fingerprints[i]->settle_t[sample_number] = settle_t;
+		fingerprints[i]->settle_timed_out[sample_number] = timed_out;
+		fingerprints[i]->vrefint[sample_number] = vrefint;
+	}
+}
+
+static void charge(Fingerprinter ** fingerprints, size_t count, size_t sample_number) {
+	mark_phase(fingerprints, count, sample_number, PHASE_CHARGE);
+	for (size_t i = 0; i < count; i++) {
+		HAL_GPIO_WritePin(fingerprints[i]->test_pin_bank, fingerprints[i]->test_pin,
+				GPIO_PIN_SET);
+	}
 }
 
 static void setup(Fingerprinter * fingerprint) {
@@ -132,47 +845,278 @@ static void teardown(Fingerprinter * fingerprint, int op_pin_mode) {
 			fingerprint->op_pin, op_pin_mode);
 }
 
-void init_fingerprinter(Fingerprinter * fingerprint, const char * name, void * test_pin_bank,
+size_t get_fingerprinter_arena_free(void) {
+	return sizeof(arena) - arena_used * sizeof(uint32_t);
+}
+
+void reset_fingerprinter_arena(void) {
+	// Invalidates the buffers of every fingerprinter initialised so far
+	arena_used = 0;
+}
+
+int init_fingerprinter(Fingerprinter * fingerprint, const char * name, void * test_pin_bank,
 		unsigned int test_pin, void * op_pin_bank, unsigned int op_pin, void * uart,
 		void * timer, void * adc, unsigned int sample_size, unsigned int num_of_samples) {
+	if (fingerprint == NULL) {
+		return -1;
+	}
+
+	fingerprint->name = name;
+	fingerprint->test_pin_bank = test_pin_bank;
+	fingerprint->test_pin = test_pin;
+	fingerprint->op_pin_bank = op_pin_bank;
+	fingerprint->op_pin = op_pin;
+	compute_gpio_masks(test_pin, &fingerprint->test_pin_masks);
+	compute_gpio_masks(op_pin, &fingerprint->op_pin_masks);
+	fingerprint->timer = timer;
+	fingerprint->uart = uart;
+	fingerprint->adc = adc;
+	fingerprint->adc_channel = ADC_CHANNEL_10;	// regular channel set up by MX_ADC1_Init
+	fingerprint->acquisition_profile = ACQUISITION_FAST;
+	fingerprint->timer = timer;
+	fingerprint->sample_size = sample_size;
+	fingerprint->num_of_samples = num_of_samples;
+	fingerprint->samples = (uint16_t*) arena_alloc(num_of_samples * sample_size * sizeof(uint16_t));
+	fingerprint->delta_t = (unsigned long*) arena_alloc(num_of_samples * sizeof(unsigned long));
+	fingerprint->sample_t = NULL;
+	fingerprint->settle_t = (unsigned long*) arena_alloc(num_of_samples * sizeof(unsigned long));
+	fingerprint->settle_timed_out = (uint8_t*) arena_alloc(num_of_samples * sizeof(uint8_t));
+	fingerprint->settle_t_hz = 0;
+	fingerprint->vrefint = (uint16_t*) arena_alloc(num_of_samples * sizeof(uint16_t));
+	fingerprint->ts_data = (uint16_t*) arena_alloc(num_of_samples * sizeof(uint16_t));
+	fingerprint->supply_correction = 0;
+	fingerprint->value_encoding = VALUES_INTEGERS;
+	// Optional, without it the encoder builds the Target for every series
+	fingerprint->target_cbor = (uint8_t*) arena_alloc(TARGET_CBOR_SIZE);
+	fingerprint->target_cbor_len = 0;
+	fingerprint->target_cbor_calfact = 0;
+	fingerprint->settle_threshold = DEFAULT_SETTLE_THRESHOLD;
+	fingerprint->settle_timeout_ms = DEFAULT_SETTLE_TIMEOUT_MS;
+	fingerprint->capture_mode = CAPTURE_POLLED;
+	fingerprint->capture_done = 0;
+	fingerprint->trigger_timer = NULL;
+	fingerprint->sample_rate_hz = 0;
+	fingerprint->trigger_rate_hz = 0;
+	fingerprint->timing_backend = TIMING_TIM1;
+	fingerprint->delta_t_hz = 0;
+	fingerprint->phase_timing = 0;
+	fingerprint->phase_t = NULL;
+	fingerprint->cycle_clock_hz = 0;
+	fingerprint->capture_clock_hz = 0;
+	fingerprint->repetitions = 0;
+	fingerprint->stat_mean = NULL;
+	fingerprint->stat_m2 = NULL;
+	fingerprint->stat_delta_t = 0;
+	fingerprint->rc_feature_mode = RC_FEATURES_OFF;
+	fingerprint->rc_features = NULL;
+	fingerprint->state = FINGERPRINT_IDLE;
+	fingerprint->on_complete = NULL;
+	fingerprint->async_op_pin_mode = 0;
+	fingerprint->async_sample = 0;
+
+	if (fingerprint->samples == NULL || fingerprint->delta_t == NULL ||
+			fingerprint->settle_t == NULL || fingerprint->settle_timed_out == NULL ||
+			fingerprint->vrefint == NULL ||
+			fingerprint->ts_data == NULL) {
+		print_string(uart, "[ERROR] fingerprinter arena exhausted\r\n");
+		return -1;
+	}
+	update_target_cache(fingerprint);
+	return 0;
+}
+
+void set_capture_mode(Fingerprinter * fingerprint, CaptureMode mode) {
+	if (fingerprint != NULL) {
+		// Timer triggered captures need a timer and a rate, see set_trigger_timer
+		if (mode == CAPTURE_TIMER_TRIGGERED &&
+				(fingerprint->trigger_timer == NULL || fingerprint->sample_rate_hz == 0)) {
+			print_string(fingerprint->uart, "[ERROR] no trigger timer configured\r\n");
+			return;
+		}
+		if (mode == CAPTURE_TIMER_TRIGGERED && !trigger_period_fits(fingerprint,
+				fingerprint->acquisition_profile, fingerprint->sample_rate_hz, 1)) {
+			return;
+		}
+		if (mode == CAPTURE_TIMESTAMPED && fingerprint->sample_t == NULL) {
+			fingerprint->sample_t = (unsigned long*) arena_alloc(fingerprint->num_of_samples *
+					fingerprint->sample_size * sizeof(unsigned long));
+			if (fingerprint->sample_t == NULL) {
+				print_string(fingerprint->uart, "[ERROR] no memory for sample timestamps\r\n");
+				return;
+			}
+		}
+		fingerprint->capture_mode = mode;
+	}
+}
+
+void set_trigger_timer(Fingerprinter * fingerprint, void * trigger_timer,
+		unsigned long sample_rate_hz) {
+	if (fingerprint != NULL && trigger_timer != NULL && sample_rate_hz != 0 &&
+			trigger_period_fits(fingerprint, fingerprint->acquisition_profile, sample_rate_hz, 1)) {
+		fingerprint->trigger_timer = trigger_timer;
+		fingerprint->sample_rate_hz = sample_rate_hz;
+	}
+}
+
+void set_settle_detection(Fingerprinter * fingerprint, unsigned int threshold,
+		unsigned int timeout_ms) {
+	// timeout_ms bounds each of the two discharge phases, like the former fixed delays
+	if (fingerprint != NULL) {
+		fingerprint->settle_threshold = threshold;
+		fingerprint->settle_timeout_ms = timeout_ms;
+	}
+}
+
+void set_timing_backend(Fingerprinter * fingerprint, TimingBackend backend) {
+	if (fingerprint != NULL) {
+		if (backend == TIMING_DWT) {
+			enable_cycle_counter();
+		}
+		fingerprint->timing_backend = backend;
+	}
+}
+
+void set_phase_timing(Fingerprinter * fingerprint, int enabled) {
+	if (fingerprint == NULL) {
+		return;
+	}
+	// The arena cannot free, so the buffer is kept for later captures once allocated
+	if (enabled && fingerprint->phase_t == NULL) {
+		fingerprint->phase_t = (unsigned long*) arena_alloc(fingerprint->num_of_samples *
+				NUM_OF_PHASE_MARKS * sizeof(unsigned long));
+		if (fingerprint->phase_t == NULL) {
+			print_string(fingerprint->uart, "[ERROR] no memory for phase timestamps\r\n");
+			return;
+		}
+		memset(fingerprint->phase_t, 0, fingerprint->num_of_samples *
+				NUM_OF_PHASE_MARKS * sizeof(unsigned long));
+	}
+	if (enabled) {
+		// Phase timestamps always come from the cycle counter, whatever backend times delta_t
+		enable_cycle_counter();
+	}
+	fingerprint->phase_timing = enabled;
+}
+
+unsigned long get_phase_cycles(const Fingerprinter * fingerprint, size_t sample_number,
+		TimingPhase phase) {
+	if (fingerprint == NULL || !fingerprint->phase_timing || phase >= PHASE_END ||
+			sample_number >= fingerprint->num_of_samples) {
+		return 0;
+	}
+	const unsigned long * marks = &fingerprint->phase_t[sample_number * NUM_OF_PHASE_MARKS];
+	return marks[phase + 1] - marks[phase];
+}
+
+void set_rc_features(Fingerprinter * fingerprint, RcFeatureMode mode) {
+	if (fingerprint == NULL) {
+		return;
+	}
+	if (mode != RC_FEATURES_OFF && fingerprint->rc_features == NULL) {
+		fingerprint->rc_features = (int32_t*) arena_alloc(fingerprint->num_of_samples *
+				NUM_OF_RC_FEATURES * sizeof(int32_t));
+		if (fingerprint->rc_features == NULL) {
+			print_string(fingerprint->uart, "[ERROR] no memory for RC features\r\n");
+			return;
+		}
+	}
+	fingerprint->rc_feature_mode = mode;
+}
+
+void set_supply_correction(Fingerprinter * fingerprint, int enabled) {
+	if (fingerprint != NULL) {
+		fingerprint->supply_correction = enabled;
+	}
+}
+
+void set_value_encoding(Fingerprinter * fingerprint, ValueEncoding encoding) {
+	if (fingerprint != NULL) {
+		fingerprint->value_encoding = encoding;
+	}
+}
+
+unsigned long get_settle_us(const Fingerprinter * fingerprint, size_t sample_number) {
+	unsigned long ticks = fingerprint->settle_t[sample_number];
+	// settle_t counts ticks of the microsecond timer, exact microseconds only at 1 MHz
+	if (fingerprint->settle_t_hz == 0 || fingerprint->settle_t_hz == 1000000) {
+		return ticks;
+	}
+	return (unsigned long) (((uint64_t) ticks * 1000000 + fingerprint->settle_t_hz / 2) /
+			fingerprint->settle_t_hz);
+}
+
+unsigned long get_vdda_mv(const Fingerprinter * fingerprint, size_t sample_number) {
+	if (fingerprint == NULL || sample_number >= fingerprint->num_of_samples ||
+			fingerprint->vrefint[sample_number] == 0) {
+		return 0;
+	}
+	// VREFINT_CAL was taken at a known VDDA, the ratio gives the VDDA of this capture
+	return __LL_ADC_CALC_VREFANALOG_VOLTAGE(fingerprint->vrefint[sample_number],
+			LL_ADC_RESOLUTION_12B);
+}
+
+int get_temperature_c(const Fingerprinter * fingerprint, size_t sample_number,
+		int * temperature_c) {
+	if (fingerprint == NULL || temperature_c == NULL ||
+			sample_number >= fingerprint->num_of_samples || fingerprint->ts_data[sample_number] == 0) {
+		return -1;
+	}
+	// The sensor calibration points are relative to VDDA as well
+	unsigned long vdda_mv = get_vdda_mv(fingerprint, sample_number);
+	if (vdda_mv == 0) {
+		vdda_mv = V_REF_MV;
+	}
+	*temperature_c = __LL_ADC_CALC_TEMPERATURE(vdda_mv, fingerprint->ts_data[sample_number],
+			LL_ADC_RESOLUTION_12B);
+	return 0;
+}
+
+void set_adc_channel(Fingerprinter * fingerprint, unsigned int adc_channel) {
 	if (fingerprint != NULL) {
-		fingerprint->name = name;
-		fingerprint->test_pin_bank = test_pin_bank;
-		fingerprint->test_pin = test_pin;
-		fingerprint->op_pin_bank = op_pin_bank;
-		fingerprint->op_pin = op_pin;
-		fingerprint->timer = timer;
-		fingerprint->uart = uart;
-		fingerprint->adc = adc;
-		fingerprint->timer = timer;
-		fingerprint->sample_size = sample_size;
-		fingerprint->num_of_samples = num_of_samples;
-		fingerprint->samples = (unsigned int*) malloc(num_of_samples * sample_size * sizeof(unsigned int));
-		fingerprint->delta_t = (unsigned long*) malloc(num_of_samples * sizeof(unsigned long));
+		fingerprint->adc_channel = adc_channel;
 	}
 }
 
+void set_acquisition_profile(Fingerprinter * fingerprint, AcquisitionProfile profile) {
+	if (fingerprint != NULL && (size_t) profile < NUM_OF_ACQUISITION_PROFILES) {
+		if (fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED &&
+				!trigger_period_fits(fingerprint, profile, fingerprint->sample_rate_hz, 1)) {
+			return;
+		}
+		fingerprint->acquisition_profile = profile;
+		update_target_cache(fingerprint);	// the Target names the profile
+	}
+}
+
+__weak void update_target_cache(Fingerprinter * fingerprint) {
+	// Without the CBOR encoder there is nothing to cache
+	fingerprint->target_cbor_len = 0;
+}
+
+const char * get_acquisition_profile_name(AcquisitionProfile profile) {
+	if ((size_t) profile < NUM_OF_ACQUISITION_PROFILES) {
+		return acquisition_profiles[profile].name;
+	}
+	return "unknown";
+}
+
+unsigned int get_oversampling_ratio(AcquisitionProfile profile) {
+	if ((size_t) profile < NUM_OF_ACQUISITION_PROFILES) {
+		return acquisition_profiles[profile].ratio;
+	}
+	return 0;
+}
+
 void get_and_print_fingerprint(Fingerprinter * fingerprint, int op_pin_mode) {
 	if (fingerprint != NULL) {
-		GPIO_TypeDef * op_pin_bank = (GPIO_TypeDef*) fingerprint->op_pin_bank;
-		GPIO_TypeDef * test_pin_bank = (GPIO_TypeDef*) fingerprint->test_pin_bank;
 		setup(fingerprint);
+		fingerprint->repetitions = 0;
+		configure_adc(&fingerprint, 1);
 		for (size_t sample = 0; sample < fingerprint->num_of_samples; sample++) {
-			// Draw the line low
-			set_gpio_mode(op_pin_bank, fingerprint->op_pin, OUT);
-			set_gpio_mode(test_pin_bank, fingerprint->test_pin, OUT);
-			HAL_GPIO_WritePin(op_pin_bank, fingerprint->op_pin,
-					GPIO_PIN_RESET);
-			HAL_GPIO_WritePin(test_pin_bank, fingerprint->test_pin,
-								GPIO_PIN_RESET);
-			HAL_Delay(100);
-
-			set_gpio_mode(op_pin_bank, fingerprint->op_pin, IN);
-			HAL_Delay(100);
-			HAL_GPIO_WritePin(test_pin_bank, fingerprint->test_pin,
-											GPIO_PIN_SET);
-
-			measure(fingerprint, sample);
+			discharge(&fingerprint, 1, sample);
+			charge(&fingerprint, 1, sample);
+
+			measure(&fingerprint, 1, sample, NULL);
 
 			print_samples(fingerprint, sample);
 		}
@@ -182,27 +1126,549 @@ void get_and_print_fingerprint(Fingerprinter * fingerprint, int op_pin_mode) {
 
 void get_fingerprint(Fingerprinter * fingerprint, int op_pin_mode){
 	if (fingerprint != NULL) {
-		GPIO_TypeDef * op_pin_bank = (GPIO_TypeDef*) fingerprint->op_pin_bank;
-		GPIO_TypeDef * test_pin_bank = (GPIO_TypeDef*) fingerprint->test_pin_bank;
+		fingerprint->repetitions = 0;
+		configure_adc(&fingerprint, 1);
 		for (size_t sample = 0; sample < fingerprint->num_of_samples; sample++) {
-			// Draw the line low
-			set_gpio_mode(op_pin_bank, fingerprint->op_pin, OUT);
-			set_gpio_mode(test_pin_bank, fingerprint->test_pin, OUT);
-			HAL_GPIO_WritePin(op_pin_bank, fingerprint->op_pin,
-					GPIO_PIN_RESET);
-			HAL_GPIO_WritePin(test_pin_bank, fingerprint->test_pin,
-								GPIO_PIN_RESET);
-			HAL_Delay(100);
-
-			set_gpio_mode(op_pin_bank, fingerprint->op_pin, IN);
-			HAL_Delay(100);
-			HAL_GPIO_WritePin(test_pin_bank, fingerprint->test_pin,
-											GPIO_PIN_SET);
-
-			measure(fingerprint, sample);
+			discharge(&fingerprint, 1, sample);
+			charge(&fingerprint, 1, sample);
+
+			measure(&fingerprint, 1, sample, NULL);
 		}
 		// Disable Test Pin domain and enable Operation pin domain
 		set_gpio_mode(fingerprint->test_pin_bank, fingerprint->test_pin, IN);
 		set_gpio_mode(fingerprint->op_pin_bank, fingerprint->op_pin, op_pin_mode);
 	}
 }
+
+void get_fingerprint_scan(Fingerprinter ** fingerprints, size_t count,
+		const int * op_pin_modes) {
+	if (fingerprints == NULL || count == 0 || count > MAX_SCAN_CHANNELS) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		// All loads are sampled by the same sequence, so they have to agree on its shape.
+		// The sequence runs on DMA, which leaves no end of conversion to timestamp.
+		if (fingerprints[i] == NULL || fingerprints[i]->adc != fingerprints[0]->adc ||
+				fingerprints[i]->sample_size != fingerprints[0]->sample_size ||
+				fingerprints[i]->num_of_samples != fingerprints[0]->num_of_samples ||
+				(count > 1 && fingerprints[i]->capture_mode == CAPTURE_TIMESTAMPED)) {
+			print_string(fingerprints[0]->uart, "[ERROR] incompatible fingerprinters for scan\r\n");
+			return;
+		}
+	}
+	for (size_t i = 0; i < count; i++) {
+		fingerprints[i]->repetitions = 0;
+	}
+
+	// The scan buffer only lives for this call, give its arena space back at the end
+	size_t arena_mark = arena_used;
+	uint16_t * scan_buffer = NULL;
+	if (count > 1) {
+		scan_buffer = (uint16_t *) arena_alloc(count * fingerprints[0]->sample_size *
+				sizeof(uint16_t));
+		if (scan_buffer == NULL) {
+			print_string(fingerprints[0]->uart, "[ERROR] no memory for scan buffer\r\n");
+			return;
+		}
+	}
+	size_t scratch_end = arena_used;
+
+	configure_adc(fingerprints, count);
+	for (size_t sample = 0; sample < fingerprints[0]->num_of_samples; sample++) {
+		discharge(fingerprints, count, sample);
+		charge(fingerprints, count, sample);
+
+		measure(fingerprints, count, sample, scan_buffer);
+	}
+	arena_release(arena_mark, scratch_end, fingerprints[0]->uart);
+
+	// Disable Test Pin domain and enable Operation pin domain
+	for (size_t i = 0; i < count; i++) {
+		set_gpio_mode(fingerprints[i]->test_pin_bank, fingerprints[i]->test_pin, IN);
+		set_gpio_mode(fingerprints[i]->op_pin_bank, fingerprints[i]->op_pin, op_pin_modes[i]);
+	}
+}
+
+static void update_statistics(Fingerprinter * fingerprint) {
+	// Welford's online algorithm, stable in single precision without keeping the runs
+	unsigned int n = ++fingerprint->repetitions;
+	for (size_t i = 0; i < fingerprint->sample_size; i++) {
+		float value = (float) fingerprint->samples[i];
+		float delta = value - fingerprint->stat_mean[i];
+		fingerprint->stat_mean[i] += delta / n;
+		fingerprint->stat_m2[i] += delta * (value - fingerprint->stat_mean[i]);
+	}
+	fingerprint->stat_delta_t += ((float) fingerprint->delta_t[0] - fingerprint->stat_delta_t) / n;
+}
+
+static void set_dma_mode(ADC_HandleTypeDef * adc, uint32_t mode) {
+	DMA_HandleTypeDef * dma = adc->DMA_Handle;
+	if (dma != NULL && dma->Init.Mode != mode) {
+		HAL_DMA_DeInit(dma);
+		dma->Init.Mode = mode;
+		HAL_DMA_Init(dma);
+	}
+}
+
+static void stream_half_done(size_t half) {
+	// The half was written again before the callback was done with it
+	if (stream_pending[half]) {
+		stream_overrun = 1;
+	}
+	stream_pending[half] = 1;
+}
+
+int get_fingerprint_stream(Fingerprinter * fingerprint, int op_pin_mode, size_t num_of_blocks,
+		StreamCallback on_block) {
+	if (fingerprint == NULL || on_block == NULL || num_of_blocks == 0) {
+		return -1;
+	}
+	// The trigger rate has to stay below what the callback can encode and transmit
+	if (fingerprint->capture_mode != CAPTURE_TIMER_TRIGGERED) {
+		print_string(fingerprint->uart, "[ERROR] streaming needs a timer triggered capture\r\n");
+		return -1;
+	}
+
+	// Each half of the ring holds one block of sample_size conversions
+	size_t block_size = fingerprint->sample_size;
+	size_t arena_mark = arena_used;
+	uint16_t * ring = (uint16_t *) arena_alloc(2 * block_size * sizeof(uint16_t));
+	if (ring == NULL) {
+		print_string(fingerprint->uart, "[ERROR] no memory for stream buffer\r\n");
+		return -1;
+	}
+	size_t scratch_end = arena_used;
+
+	fingerprint->repetitions = 0;
+	stream_fingerprint = fingerprint;
+	configure_adc(&fingerprint, 1);
+	set_dma_mode(fingerprint->adc, DMA_CIRCULAR);
+	stream_pending[0] = 0;
+	stream_pending[1] = 0;
+	stream_overrun = 0;
+
+	// Blocks leave while the capture runs, so the environment is read up front
+	discharge(&fingerprint, 1, 0);
+	measure_environment(&fingerprint, 1, 0);
+	charge(&fingerprint, 1, 0);
+
+	// The stream head sent with the first block carries the clock and time base
+	start_timing(fingerprint);
+	int status = start_dma_capture(fingerprint, ring, 2 * block_size);
+	uint32_t timeout = get_capture_timeout(fingerprint);
+	for (size_t block = 0; status == 0 && block < num_of_blocks; block++) {
+		size_t half = block % 2;
+		uint32_t start_tick = HAL_GetTick();
+		while (!stream_pending[half]) {
+			if (HAL_GetTick() - start_tick > timeout) {
+				print_string(fingerprint->uart, "[ERROR] stream capture timed out\r\n");
+				status = -1;
+				break;
+			}
+		}
+		if (status != 0) {
+			break;
+		}
+
+		on_block(fingerprint, &ring[half * block_size], block_size, block);
+		stream_pending[half] = 0;
+		if (stream_overrun) {
+			print_string(fingerprint->uart, "[ERROR] stream overrun, lower the trigger rate\r\n");
+			status = -1;
+		}
+	}
+	if (active_capture == fingerprint) {
+		stop_dma_capture(fingerprint);
+	}
+
+	stream_fingerprint = NULL;
+	set_dma_mode(fingerprint->adc, DMA_NORMAL);
+	// on_block may have allocated, e.g. by enabling phase timing
+	arena_release(arena_mark, scratch_end, fingerprint->uart);
+
+	// Disable Test Pin domain and enable Operation pin domain
+	set_gpio_mode(fingerprint->test_pin_bank, fingerprint->test_pin, IN);
+	set_gpio_mode(fingerprint->op_pin_bank, fingerprint->op_pin, op_pin_mode);
+	return status;
+}
+
+void get_fingerprint_statistics(Fingerprinter * fingerprint, int op_pin_mode,
+		unsigned int repetitions) {
+	if (fingerprint == NULL || repetitions == 0) {
+		return;
+	}
+	if (fingerprint->stat_mean == NULL) {
+		// Both buffers or none, so a failed attempt leaves the arena as it was
+		size_t arena_mark = arena_used;
+		float * stat_mean = (float*) arena_alloc(fingerprint->sample_size * sizeof(float));
+		float * stat_m2 = (float*) arena_alloc(fingerprint->sample_size * sizeof(float));
+		if (stat_mean == NULL || stat_m2 == NULL) {
+			arena_used = arena_mark;
+			print_string(fingerprint->uart, "[ERROR] no memory for statistics\r\n");
+			return;
+		}
+		fingerprint->stat_mean = stat_mean;
+		fingerprint->stat_m2 = stat_m2;
+	}
+	memset(fingerprint->stat_mean, 0, fingerprint->sample_size * sizeof(float));
+	memset(fingerprint->stat_m2, 0, fingerprint->sample_size * sizeof(float));
+	fingerprint->stat_delta_t = 0;
+	fingerprint->repetitions = 0;
+
+	configure_adc(&fingerprint, 1);
+	for (unsigned int run = 0; run < repetitions; run++) {
+		// Every run reuses the buffers of the first sample
+		discharge(&fingerprint, 1, 0);
+		charge(&fingerprint, 1, 0);
+
+		measure(&fingerprint, 1, 0, NULL);
+		update_statistics(fingerprint);
+	}
+	// Disable Test Pin domain and enable Operation pin domain
+	set_gpio_mode(fingerprint->test_pin_bank, fingerprint->test_pin, IN);
+	set_gpio_mode(fingerprint->op_pin_bank, fingerprint->op_pin, op_pin_mode);
+}
+
+float get_sample_variance(const Fingerprinter * fingerprint, size_t index) {
+	// Unbiased sample variance, undefined for a single run
+	if (fingerprint == NULL || fingerprint->repetitions < 2 ||
+			index >= fingerprint->sample_size) {
+		return 0;
+	}
+	return fingerprint->stat_m2[index] / (fingerprint->repetitions - 1);
+}
+
+static void async_begin_sample(Fingerprinter * fingerprint) {
+	fingerprint->settle_t[fingerprint->async_sample] = 0;
+	fingerprint->settle_timed_out[fingerprint->async_sample] = 0;
+	fingerprint->vrefint[fingerprint->async_sample] = 0;
+	fingerprint->ts_data[fingerprint->async_sample] = 0;
+	fingerprint->settle_probes = 0;
+	fingerprint->settle_last = __HAL_TIM_GET_COUNTER((TIM_HandleTypeDef *) fingerprint->timer);
+	fingerprint->phase_start_tick = HAL_GetTick();
+	fingerprint->state = FINGERPRINT_DISCHARGE;
+	mark_phase(&fingerprint, 1, fingerprint->async_sample, PHASE_DISCHARGE);
+	draw_low(&fingerprint, 1);
+}
+
+static void async_finish(Fingerprinter * fingerprint, FingerprintState state) {
+	// Disable Test Pin domain and enable Operation pin domain
+	set_gpio_mode(fingerprint->test_pin_bank, fingerprint->test_pin, IN);
+	set_gpio_mode(fingerprint->op_pin_bank, fingerprint->op_pin, fingerprint->async_op_pin_mode);
+
+	async_fingerprint = NULL;
+	fingerprint->state = state;
+	if (fingerprint->on_complete != NULL) {
+		fingerprint->on_complete(fingerprint);
+	}
+}
+
+static void async_complete_sample(Fingerprinter * fingerprint) {
+	finish_timing(&fingerprint, 1, fingerprint->async_sample, NULL, fingerprint->capture_start, 0);
+
+	fingerprint->async_sample++;
+	if (fingerprint->async_sample < fingerprint->num_of_samples) {
+		async_begin_sample(fingerprint);
+	} else {
+		async_finish(fingerprint, FINGERPRINT_DONE);
+	}
+}
+
+static void async_start_capture(Fingerprinter * fingerprint) {
+	uint16_t * samples = &fingerprint->samples[
+			fingerprint->async_sample * fingerprint->sample_size];
+
+	charge(&fingerprint, 1, fingerprint->async_sample);
+	fingerprint->capture_start = start_timing(fingerprint);
+	mark_phase(&fingerprint, 1, fingerprint->async_sample, PHASE_CAPTURE);
+
+	fingerprint->phase_start_tick = HAL_GetTick();
+	fingerprint->state = FINGERPRINT_CAPTURE;
+	if (start_dma_capture(fingerprint, samples, fingerprint->sample_size) != 0) {
+		async_finish(fingerprint, FINGERPRINT_ERROR);
+	}
+}
+
+static void async_step(Fingerprinter * fingerprint) {
+	TIM_HandleTypeDef * timer = (TIM_HandleTypeDef *) fingerprint->timer;
+	uint32_t phase_ticks = HAL_GetTick() - fingerprint->phase_start_tick;
+
+	switch (fingerprint->state) {
+	case FINGERPRINT_DISCHARGE:
+	case FINGERPRINT_RELEASE:
+		// One settle probe per tick instead of the busy loop of wait_settled
+		fingerprint->settle_probes = probe_settled(&fingerprint, 1,
+				&fingerprint->vrefint[fingerprint->async_sample]) ?
+				fingerprint->settle_probes + 1 : 0;
+		fingerprint->settle_t[fingerprint->async_sample] +=
+				elapsed_ticks(timer, &fingerprint->settle_last);
+		if (fingerprint->settle_probes < SETTLE_CONSECUTIVE_PROBES &&
+				phase_ticks < fingerprint->settle_timeout_ms) {
+			break;
+		}
+		if (fingerprint->settle_probes < SETTLE_CONSECUTIVE_PROBES) {
+			fingerprint->settle_timed_out[fingerprint->async_sample] = 1;
+		}
+
+		if (fingerprint->state == FINGERPRINT_DISCHARGE) {
+			release_op_pins(&fingerprint, 1);
+			fingerprint->settle_probes = 0;
+			fingerprint->phase_start_tick = HAL_GetTick();
+			fingerprint->state = FINGERPRINT_RELEASE;
+		} else {
+			async_start_capture(fingerprint);
+		}
+		break;
+	case FINGERPRINT_CAPTURE:
+		// Completion is signalled by HAL_ADC_ConvCpltCallback through capture_done
+		if (fingerprint->capture_done) {
+			stop_dma_capture(fingerprint);
+			async_complete_sample(fingerprint);
+		} else if (phase_ticks > get_capture_timeout(fingerprint)) {
+			stop_dma_capture(fingerprint);
+			print_string(fingerprint->uart, "[ERROR] ADC DMA capture timed out\r\n");
+			async_finish(fingerprint, FINGERPRINT_ERROR);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+int start_fingerprint_async(Fingerprinter * fingerprint, int op_pin_mode,
+		FingerprintCallback on_complete) {
+	if (fingerprint == NULL) {
+		return -1;
+	}
+	if (async_fingerprint != NULL) {
+		print_string(fingerprint->uart, "[ERROR] asynchronous capture already running\r\n");
+		return -1;
+	}
+	if (fingerprint->capture_mode != CAPTURE_DMA &&
+			fingerprint->capture_mode != CAPTURE_TIMER_TRIGGERED) {
+		// Polled conversions would block the caller for the whole capture
+		print_string(fingerprint->uart, "[ERROR] asynchronous capture needs a DMA capture mode\r\n");
+		return -1;
+	}
+
+	configure_adc(&fingerprint, 1);
+	fingerprint->repetitions = 0;
+	fingerprint->on_complete = on_complete;
+	fingerprint->async_op_pin_mode = op_pin_mode;
+	fingerprint->async_sample = 0;
+	async_begin_sample(fingerprint);
+
+	// Hand over to poll_fingerprint_async only once the capture is fully prepared
+	async_tick_pending = 0;
+	async_fingerprint = fingerprint;
+	return 0;
+}
+
+FingerprintState poll_fingerprint_async(Fingerprinter * fingerprint) {
+	if (fingerprint == NULL) {
+		return FINGERPRINT_ERROR;
+	}
+	// Probes, pin switches and the completion callback run here in thread context,
+	// the interrupts only leave async_tick_pending and capture_done behind
+	if (fingerprint == async_fingerprint && (async_tick_pending ||
+			(fingerprint->state == FINGERPRINT_CAPTURE && fingerprint->capture_done))) {
+		async_tick_pending = 0;
+		async_step(fingerprint);
+	}
+	return fingerprint->state;
+}
+
+void fingerprinter_tick(void) {
+	// Called from SysTick_Handler, the next poll_fingerprint_async advances the capture
+	if (async_fingerprint != NULL) {
+		async_tick_pending = 1;
+	}
+}
+
+static int interleave_start_capture(Fingerprinter ** fingerprints, size_t count,
+		Fingerprinter * fingerprint) {
+	ADC_HandleTypeDef * adc = (ADC_HandleTypeDef *) fingerprint->adc;
+	TIM_HandleTypeDef * timer = (TIM_HandleTypeDef *) fingerprint->timer;
+	uint16_t * samples = &fingerprint->samples[
+			fingerprint->async_sample * fingerprint->sample_size];
+
+	// Only this line is converted, the others keep settling meanwhile
+	LL_ADC_REG_SetSequencerLength(adc->Instance, LL_ADC_REG_SEQ_SCAN_DISABLE);
+	LL_ADC_REG_SetSequencerRanks(adc->Instance, LL_ADC_REG_RANK_1, fingerprint->adc_channel);
+	if (fingerprint->capture_mode == CAPTURE_TIMER_TRIGGERED) {
+		configure_trigger_timer(fingerprint);
+	}
+
+	// start_timing may restart the shared microsecond timer, so settle times are
+	// brought up to date before and continue from the restarted counter after
+	for (size_t i = 0; i < count; i++) {
+		if (fingerprints[i] != fingerprint && (fingerprints[i]->state == FINGERPRINT_DISCHARGE ||
+				fingerprints[i]->state == FINGERPRINT_RELEASE)) {
+			fingerprints[i]->settle_t[fingerprints[i]->async_sample] +=
+					elapsed_ticks(timer, &fingerprints[i]->settle_last);
+		}
+	}
+	charge(&fingerprint, 1, fingerprint->async_sample);
+	fingerprint->capture_start = start_timing(fingerprint);
+	for (size_t i = 0; i < count; i++) {
+		fingerprints[i]->settle_last = __HAL_TIM_GET_COUNTER(timer);
+	}
+	mark_phase(&fingerprint, 1, fingerprint->async_sample, PHASE_CAPTURE);
+
+	fingerprint->phase_start_tick = HAL_GetTick();
+	fingerprint->state = FINGERPRINT_CAPTURE;
+	return start_dma_capture(fingerprint, samples, fingerprint->sample_size);
+}
+
+static int interleave_step(Fingerprinter ** fingerprints, size_t count,
+		Fingerprinter ** capturing) {
+	TIM_HandleTypeDef * timer = (TIM_HandleTypeDef *) fingerprints[0]->timer;
+	Fingerprinter * fingerprint = *capturing;
+
+	if (fingerprint != NULL) {
+		// The ADC belongs to one capture at a time, the other lines discharge meanwhile
+		if (fingerprint->capture_done) {
+			stop_dma_capture(fingerprint);
+			finish_timing(&fingerprint, 1, fingerprint->async_sample, NULL,
+					fingerprint->capture_start, 0);
+			fingerprint->async_sample++;
+			if (fingerprint->async_sample < fingerprint->num_of_samples) {
+				async_begin_sample(fingerprint);
+			} else {
+				async_finish(fingerprint, FINGERPRINT_DONE);
+			}
+			*capturing = NULL;
+		} else if (HAL_GetTick() - fingerprint->phase_start_tick >
+				get_capture_timeout(fingerprint)) {
+			stop_dma_capture(fingerprint);
+			print_string(fingerprint->uart, "[ERROR] ADC DMA capture timed out\r\n");
+			async_finish(fingerprint, FINGERPRINT_ERROR);
+			*capturing = NULL;
+			return -1;
+		}
+		return 0;
+	}
+
+	// One probe of the injected sequence covers every line
+	uint16_t vrefint = 0;
+	unsigned int settled = probe_lines(fingerprints, count, &vrefint);
+	for (size_t i = 0; i < count; i++) {
+		fingerprint = fingerprints[i];
+		size_t sample = fingerprint->async_sample;
+		if (fingerprint->state != FINGERPRINT_DISCHARGE &&
+				fingerprint->state != FINGERPRINT_RELEASE) {
+			continue;
+		}
+
+		fingerprint->settle_probes = (settled & (1U << i)) ? fingerprint->settle_probes + 1 : 0;
+		fingerprint->settle_t[sample] += elapsed_ticks(timer, &fingerprint->settle_last);
+		if (vrefint != 0) {
+			fingerprint->vrefint[sample] = vrefint;
+		}
+		if (fingerprint->settle_probes < SETTLE_CONSECUTIVE_PROBES &&
+				HAL_GetTick() - fingerprint->phase_start_tick < fingerprint->settle_timeout_ms) {
+			continue;
+		}
+		if (fingerprint->settle_probes < SETTLE_CONSECUTIVE_PROBES) {
+			fingerprint->settle_timed_out[sample] = 1;
+		}
+
+		if (fingerprint->state == FINGERPRINT_DISCHARGE) {
+			release_op_pins(&fingerprint, 1);
+			fingerprint->settle_probes = 0;
+			fingerprint->phase_start_tick = HAL_GetTick();
+			fingerprint->state = FINGERPRINT_RELEASE;
+		} else {
+			// The settle clock stops here, the wait for the ADC is not part of settle_t
+			fingerprint->state = FINGERPRINT_READY;
+		}
+	}
+
+	// Lines are captured in the order of fingerprints once they settled
+	for (size_t i = 0; i < count; i++) {
+		fingerprint = fingerprints[i];
+		if (fingerprint->state == FINGERPRINT_READY) {
+			*capturing = fingerprint;
+			if (interleave_start_capture(fingerprints, count, fingerprint) != 0) {
+				async_finish(fingerprint, FINGERPRINT_ERROR);
+				*capturing = NULL;
+				return -1;
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+int get_fingerprint_interleaved(Fingerprinter ** fingerprints, size_t count,
+		const int * op_pin_modes) {
+	if (fingerprints == NULL || op_pin_modes == NULL || count == 0 ||
+			count > MAX_SCAN_CHANNELS) {
+		return -1;
+	}
+	for (size_t i = 0; i < count; i++) {
+		// Captures run on DMA so the other lines can be probed in between,
+		// the first fingerprinter decides on the acquisition profile and the
+		// ADC trigger source for all of them
+		if (fingerprints[i] == NULL || fingerprints[i]->adc != fingerprints[0]->adc ||
+				fingerprints[i]->timer != fingerprints[0]->timer ||
+				fingerprints[i]->trigger_timer != fingerprints[0]->trigger_timer ||
+				fingerprints[i]->capture_mode != fingerprints[0]->capture_mode ||
+				(fingerprints[i]->capture_mode != CAPTURE_DMA &&
+				fingerprints[i]->capture_mode != CAPTURE_TIMER_TRIGGERED)) {
+			print_string(fingerprints[0]->uart, "[ERROR] incompatible fingerprinters for interleaving\r\n");
+			return -1;
+		}
+	}
+	if (async_fingerprint != NULL) {
+		print_string(fingerprints[0]->uart, "[ERROR] asynchronous capture already running\r\n");
+		return -1;
+	}
+
+	// The scan configuration sets sampling times and settle probes for every line,
+	// each capture then narrows the regular sequence down to its own channel
+	configure_adc(fingerprints, count);
+	for (size_t i = 0; i < count; i++) {
+		fingerprints[i]->repetitions = 0;
+		fingerprints[i]->on_complete = NULL;
+		fingerprints[i]->async_op_pin_mode = op_pin_modes[i];
+		fingerprints[i]->async_sample = 0;
+		async_begin_sample(fingerprints[i]);
+	}
+
+	Fingerprinter * capturing = NULL;
+	int status = 0;
+	size_t remaining = count;
+	while (remaining > 0) {
+		if (interleave_step(fingerprints, count, &capturing) != 0) {
+			status = -1;
+		}
+		remaining = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (fingerprints[i]->state != FINGERPRINT_DONE &&
+					fingerprints[i]->state != FINGERPRINT_ERROR) {
+				remaining++;
+			}
+		}
+	}
+	return status;
+}
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef * hadc) {
+	Fingerprinter * fingerprint = stream_fingerprint;
+	if (fingerprint != NULL && fingerprint->adc == hadc) {
+		stream_half_done(0);
+	}
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef * hadc) {
+	Fingerprinter * fingerprint = active_capture;
+	if (stream_fingerprint != NULL && stream_fingerprint->adc == hadc) {
+		// The circular transfer wraps around and keeps running
+		stream_half_done(1);
+		return;
+	}
+	if (fingerprint != NULL && fingerprint->adc == hadc) {
+		fingerprint->capture_done = 1;
+	}
+}
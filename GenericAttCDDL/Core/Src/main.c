@@ -29,6 +29,7 @@
 
 #include "fingerprinter.h"
 #include "cddlEncoder.h"
+#include "adcCalibration.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -38,9 +39,11 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
-//both of these values have to be smaller than DEFAULT_MAX_QTY (analogMeasurementTypes.h) for CBOR conversion
+#define SAMPLE_RATE_HZ (100000)
+//convert_to_cbor_multi holds at most ENGINE_BUFFER_SIZE_MULTI bytes (cddlEncoder.h), convert_to_cbor_chunked has no such limit
 #define SAMPLE_SIZE (20)
 #define NUM_OF_SAMPLES (2)
+#define NUM_OF_LOADS (3)
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -56,7 +59,9 @@ TIM_HandleTypeDef htim1;
 UART_HandleTypeDef huart2;
 
 /* USER CODE BEGIN PV */
+DMA_HandleTypeDef hdma_adc1;
 
+TIM_HandleTypeDef htim2;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -66,7 +71,8 @@ static void MX_USART2_UART_Init(void);
 static void MX_TIM1_Init(void);
 static void MX_ADC1_Init(void);
 /* USER CODE BEGIN PFP */
-
+static void MX_DMA_Init(void);
+static void MX_TIM2_Init(void);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -98,7 +104,8 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+  // DMA has to be clocked before MX_ADC1_Init links it in HAL_ADC_MspInit
+  MX_DMA_Init();
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -107,17 +114,49 @@ int main(void)
   MX_TIM1_Init();
   MX_ADC1_Init();
   /* USER CODE BEGIN 2 */
+  MX_TIM2_Init();
+
+	// Offset calibration before the first capture, reloaded from flash after the first boot
+	if (init_adc_calibration(&hadc1, &huart2, DEFAULT_RECALIBRATION_INTERVAL_MS) != 0) {
+		Error_Handler();
+	}
 
-	// Initialize the fingerprinter
-	Fingerprinter fingerprinter;
-	init_fingerprinter(&fingerprinter, "Digital Load", TEST_D_GPIO_Port,
+	// Initialize one fingerprinter per load, all loads are converted by one scan sequence
+	Fingerprinter capacitive, digital, resistive;
+	if (init_fingerprinter(&capacitive, "Capacitive Load", TEST_C_GPIO_Port,
+			TEST_C_Pin, OPERATION_C_GPIO_Port, OPERATION_C_Pin, &huart2,
+			&htim1, &hadc1, SAMPLE_SIZE, NUM_OF_SAMPLES) != 0) {
+		Error_Handler();
+	}
+	set_adc_channel(&capacitive, ADC_CHANNEL_12);
+	if (init_fingerprinter(&digital, "Digital Load", TEST_D_GPIO_Port,
 			TEST_D_Pin, OPERATION_D_GPIO_Port, OPERATION_D_Pin, &huart2,
-			&htim1, &hadc1, SAMPLE_SIZE, NUM_OF_SAMPLES);
-	get_fingerprint(&fingerprinter, 1);
-	UsefulBufC EncodedCBOR;
-	QCBORError err = convert_to_cbor(&fingerprinter, &EncodedCBOR);
+			&htim1, &hadc1, SAMPLE_SIZE, NUM_OF_SAMPLES) != 0) {
+		Error_Handler();
+	}
+	set_adc_channel(&digital, ADC_CHANNEL_10);
+	if (init_fingerprinter(&resistive, "Resistive Load", TEST_R_GPIO_Port,
+			TEST_R_Pin, OPERATION_R_GPIO_Port, OPERATION_R_Pin, &huart2,
+			&htim1, &hadc1, SAMPLE_SIZE, NUM_OF_SAMPLES) != 0) {
+		Error_Handler();
+	}
+	set_adc_channel(&resistive, ADC_CHANNEL_11);
+
+	Fingerprinter * loads[NUM_OF_LOADS] = {&capacitive, &digital, &resistive};
+	const int op_pin_modes[NUM_OF_LOADS] = {0, 1, 0};//only the digital load is operated afterwards
+	for (size_t i = 0; i < NUM_OF_LOADS; i++) {
+		set_acquisition_profile(loads[i], ACQUISITION_FAST);
+		set_trigger_timer(loads[i], &htim2, SAMPLE_RATE_HZ);
+		set_capture_mode(loads[i], CAPTURE_TIMER_TRIGGERED);
+	}
+	get_fingerprint_scan(loads, NUM_OF_LOADS, op_pin_modes);
+
+	// Encode and transmit at full speed, the capture clock is tagged in every series
+	switch_clock_profile(CLOCK_PROFILE_PROCESSING);
+	size_t encoded_len = 0;
+	QCBORError err = convert_to_cbor_chunked(loads, NUM_OF_LOADS, &encoded_len);
 	/*char string_buf [40];
-	snprintf(string_buf, 40, "[STATUS] rv: %d; len: %d\r\n", err, EncodedCBOR.len);
+	snprintf(string_buf, 40, "[STATUS] rv: %d; len: %d\r\n", err, encoded_len);
 	print_string(&huart2, string_buf);*/
 
   /* USER CODE END 2 */
@@ -371,7 +410,129 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
+/**
+  * @brief Enable DMA controller clock and the ADC1 DMA channel interrupt
+  * @param None
+  * @retval None
+  */
+static void MX_DMA_Init(void)
+{
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel1_IRQn interrupt configuration */
+  /* Below TICK_INT_PRIORITY, so HAL_GetTick keeps counting while it runs */
+  HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+}
 
+/**
+  * @brief TIM2 Initialization Function
+  *        TIM2 only paces ADC1 through its TRGO update event, the rate is
+  *        set by the fingerprinter before each capture.
+  * @param None
+  * @retval None
+  */
+static void MX_TIM2_Init(void)
+{
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* Peripheral clock enable */
+  __HAL_RCC_TIM2_CLK_ENABLE();
+
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 0;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = 0xffffffff;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim2, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+
+/**
+  * @brief Switch SYSCLK between the capture and the processing clock profile
+  *        and rescale the peripherals that depend on it. The UART baud rate
+  *        is recomputed and TIM1 keeps counting microseconds.
+  * @param profile: Clock profile to switch to
+  * @retval None
+  */
+void switch_clock_profile(ClockProfile profile)
+{
+  RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+  RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+                              |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+
+  if (profile == CLOCK_PROFILE_PROCESSING)
+  {
+    /* HSI 16 MHz / PLLM 1 * PLLN 10 / PLLR 2 = 80 MHz */
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+    RCC_OscInitStruct.PLL.PLLM = 1;
+    RCC_OscInitStruct.PLL.PLLN = 10;
+    RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV7;
+    RCC_OscInitStruct.PLL.PLLQ = RCC_PLLQ_DIV2;
+    RCC_OscInitStruct.PLL.PLLR = RCC_PLLR_DIV2;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_4) != HAL_OK)
+    {
+      Error_Handler();
+    }
+  }
+  else
+  {
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    /* The PLL is only a noise source while capturing */
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_OFF;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+    {
+      Error_Handler();
+    }
+  }
+
+  /* HAL_RCC_ClockConfig already rescaled SysTick, the baud rate divider follows PCLK1 */
+  if (HAL_UART_Init(&huart2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+
+  /* TIM1 runs at PCLK2 because APB2 is not divided */
+  htim1.Init.Prescaler = HAL_RCC_GetPCLK2Freq() / 1000000 - 1;
+  __HAL_TIM_SET_PRESCALER(&htim1, htim1.Init.Prescaler);
+  htim1.Instance->EGR = TIM_EGR_UG;
+}
 /* USER CODE END 4 */
 
 /**
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file sampleKernels.c
+* @brief Aggregation kernels for packed 16 bit ADC sample buffers
+* @version 1.0
+* @date 2026-10-17
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#include <sampleKernels.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#define USE_DSP_KERNELS
+#include "stm32l4xx.h"
+#endif
+
+uint32_t kernel_sum_u16_ref(const uint16_t * samples, size_t length) {
+	uint32_t sum = 0;
+	for (size_t i = 0; i < length; i++) {
+		sum += samples[i];
+	}
+	return sum;
+}
+
+uint64_t kernel_sum_squares_u16_ref(const uint16_t * samples, size_t length) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < length; i++) {
+		sum += (uint32_t) samples[i] * samples[i];
+	}
+	return sum;
+}
+
+void kernel_accumulate_u16_ref(uint16_t * accumulator, const uint16_t * samples, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		accumulator[i] += samples[i];
+	}
+}
+
+void kernel_average_u16_ref(uint16_t * average, const uint16_t * accumulator, size_t length,
+		unsigned int shift) {
+	for (size_t i = 0; i < length; i++) {
+		average[i] = accumulator[i] >> shift;
+	}
+}
+
+void kernel_subtract_u16_ref(int16_t * difference, const uint16_t * a, const uint16_t * b,
+		size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		difference[i] = (int16_t) (a[i] - b[i]);
+	}
+}
+
+void kernel_first_difference_u16_ref(int16_t * difference, const uint16_t * samples,
+		size_t length) {
+	for (size_t i = 0; i + 1 < length; i++) {
+		difference[i] = (int16_t) (samples[i + 1] - samples[i]);
+	}
+}
+
+#ifdef USE_DSP_KERNELS
+
+// Buffers from the arena are word aligned, but a sample offset into them may not be.
+// memcpy compiles to a plain LDR/STR, which the M4 allows unaligned.
+static inline uint32_t load_pair(const void * pair) {
+	uint32_t word;
+	memcpy(&word, pair, sizeof(word));
+	return word;
+}
+
+static inline void store_pair(void * pair, uint32_t word) {
+	memcpy(pair, &word, sizeof(word));
+}
+
+uint32_t kernel_sum_u16(const uint16_t * samples, size_t length) {
+	// Both halves multiplied by one and added in a single SMLAD. The halves are signed,
+	// which the 12 bit precondition keeps positive.
+	uint32_t sum = 0;
+	size_t i = 0;
+	for (; i + 1 < length; i += 2) {
+		sum = __SMLAD(load_pair(&samples[i]), 0x00010001U, sum);
+	}
+	for (; i < length; i++) {
+		sum += samples[i];
+	}
+	return sum;
+}
+
+uint64_t kernel_sum_squares_u16(const uint16_t * samples, size_t length) {
+	// SMLALD squares both halves into a 64 bit accumulator, a 32 bit one would overflow
+	// after 64 pairs of full scale 12 bit samples
+	uint64_t sum = 0;
+	size_t i = 0;
+	for (; i + 1 < length; i += 2) {
+		uint32_t pair = load_pair(&samples[i]);
+		sum = __SMLALD(pair, pair, sum);
+	}
+	for (; i < length; i++) {
+		sum += (uint32_t) samples[i] * samples[i];
+	}
+	return sum;
+}
+
+void kernel_accumulate_u16(uint16_t * accumulator, const uint16_t * samples, size_t length) {
+	size_t i = 0;
+	for (; i + 1 < length; i += 2) {
+		store_pair(&accumulator[i], __UADD16(load_pair(&accumulator[i]), load_pair(&samples[i])));
+	}
+	for (; i < length; i++) {
+		accumulator[i] += samples[i];
+	}
+}
+
+void kernel_average_u16(uint16_t * average, const uint16_t * accumulator, size_t length,
+		unsigned int shift) {
+	// Shifting the packed word moves bits across the halves, the mask drops them again
+	uint32_t mask = (0xFFFFU >> shift) * 0x00010001U;
+	size_t i = 0;
+	for (; i + 1 < length; i += 2) {
+		store_pair(&average[i], (load_pair(&accumulator[i]) >> shift) & mask);
+	}
+	for (; i < length; i++) {
+		average[i] = accumulator[i] >> shift;
+	}
+}
+
+void kernel_subtract_u16(int16_t * difference, const uint16_t * a, const uint16_t * b,
+		size_t length) {
+	size_t i = 0;
+	for (; i + 1 < length; i += 2) {
+		store_pair(&difference[i], __SSUB16(load_pair(&a[i]), load_pair(&b[i])));
+	}
+	for (; i < length; i++) {
+		difference[i] = (int16_t) (a[i] - b[i]);
+	}
+}
+
+void kernel_first_difference_u16(int16_t * difference, const uint16_t * samples, size_t length) {
+	size_t i = 0;
+	for (; i + 2 < length; i += 2) {
+		// (x[i], x[i+1]) and (x[i+1], x[i+2]) differ by one sample
+		uint32_t current = load_pair(&samples[i]);
+		uint32_t next = __PKHBT(current >> 16, (uint32_t) samples[i + 2], 16);
+		store_pair(&difference[i], __SSUB16(next, current));
+	}
+	for (; i + 1 < length; i++) {
+		difference[i] = (int16_t) (samples[i + 1] - samples[i]);
+	}
+}
+
+#else
+
+uint32_t kernel_sum_u16(const uint16_t * samples, size_t length) {
+	return kernel_sum_u16_ref(samples, length);
+}
+
+uint64_t kernel_sum_squares_u16(const uint16_t * samples, size_t length) {
+	return kernel_sum_squares_u16_ref(samples, length);
+}
+
+void kernel_accumulate_u16(uint16_t * accumulator, const uint16_t * samples, size_t length) {
+	kernel_accumulate_u16_ref(accumulator, samples, length);
+}
+
+void kernel_average_u16(uint16_t * average, const uint16_t * accumulator, size_t length,
+		unsigned int shift) {
+	kernel_average_u16_ref(average, accumulator, length, shift);
+}
+
+void kernel_subtract_u16(int16_t * difference, const uint16_t * a, const uint16_t * b,
+		size_t length) {
+	kernel_subtract_u16_ref(difference, a, b, length);
+}
+
+void kernel_first_difference_u16(int16_t * difference, const uint16_t * samples, size_t length) {
+	kernel_first_difference_u16_ref(difference, samples, length);
+}
+
+#endif
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file stm32l4xx.h
+* @brief Host stand-in for the device header, with portable versions of the
+* CMSIS SIMD intrinsics the sample kernels use
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#ifndef MOCK_STM32L4XX_H_
+#define MOCK_STM32L4XX_H_
+
+#include <stdint.h>
+
+// Both halfwords added, carries do not cross into the other half
+static inline uint32_t __UADD16(uint32_t op1, uint32_t op2) {
+	uint32_t low = (op1 + op2) & 0xFFFF;
+	uint32_t high = ((op1 >> 16) + (op2 >> 16)) & 0xFFFF;
+	return (high << 16) | low;
+}
+
+// Both halfwords subtracted as signed values, wrapping like the instruction
+static inline uint32_t __SSUB16(uint32_t op1, uint32_t op2) {
+	uint32_t low = (uint32_t) ((int16_t) op1 - (int16_t) op2) & 0xFFFF;
+	uint32_t high = (uint32_t) ((int16_t) (op1 >> 16) - (int16_t) (op2 >> 16)) & 0xFFFF;
+	return (high << 16) | low;
+}
+
+// Products of the signed halfwords added to the accumulator
+static inline uint32_t __SMLAD(uint32_t op1, uint32_t op2, uint32_t op3) {
+	int32_t low = (int32_t) (int16_t) op1 * (int16_t) op2;
+	int32_t high = (int32_t) (int16_t) (op1 >> 16) * (int16_t) (op2 >> 16);
+	return op3 + (uint32_t) low + (uint32_t) high;
+}
+
+// Like __SMLAD, with a 64 bit accumulator
+static inline uint64_t __SMLALD(uint32_t op1, uint32_t op2, uint64_t acc) {
+	int64_t low = (int64_t) (int16_t) op1 * (int16_t) op2;
+	int64_t high = (int64_t) (int16_t) (op1 >> 16) * (int16_t) (op2 >> 16);
+	return acc + (uint64_t) (low + high);
+}
+
+// Bottom half of op1, top half of op2 shifted left
+static inline uint32_t __PKHBT(uint32_t op1, uint32_t op2, unsigned int shift) {
+	return (op1 & 0x0000FFFF) | ((op2 << shift) & 0xFFFF0000);
+}
+
+#endif /* MOCK_STM32L4XX_H_ */
@@ -0,0 +1,492 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file cddlEncoderTest.c
+* @brief Decodes the output of the direct and the chunked encoder and compares
+* both, built against the QCBOR submodule
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "halMock.h"
+#include "cddlEncoder.h"
+
+// 160 samples take 320 bytes as a typed array and more as integers, more than one chunk window
+#define SAMPLE_SIZE (160)
+#define NUM_OF_SAMPLES (2)
+#define SAMPLE_RATE_HZ (100000)
+#define ENGINE_BUFFER_SIZE (8192)
+
+static ADC_HandleTypeDef hadc1;
+static TIM_HandleTypeDef htim1;
+static TIM_HandleTypeDef htim2;
+static UART_HandleTypeDef huart2;
+
+static Fingerprinter loads[2];
+static Fingerprinter * load_pointers[2] = {&loads[0], &loads[1]};
+
+static uint8_t engine_buffer[ENGINE_BUFFER_SIZE];
+static uint8_t chunked[ENGINE_BUFFER_SIZE];
+static uint8_t canonical[ENGINE_BUFFER_SIZE];
+
+static unsigned int failures = 0;
+
+static void check(int condition, const char * test, const char * what) {
+	if (!condition) {
+		printf("FAIL %s: %s\n", test, what);
+		failures++;
+	}
+}
+
+// Minimal CBOR reader, just enough to check well-formedness and to rewrite indefinite
+// length arrays with definite heads, as the direct encoder writes them
+
+typedef struct {
+	const uint8_t * pos;
+	const uint8_t * end;
+} Cursor;
+
+static int read_head(Cursor * cursor, unsigned int * major, uint64_t * argument,
+		int * indefinite) {
+	if (cursor->pos >= cursor->end) {
+		return -1;
+	}
+	uint8_t initial = *cursor->pos++;
+	unsigned int info = initial & 0x1F;
+	*major = initial >> 5;
+	*indefinite = (info == 31);
+	*argument = info;
+	if (info < 24 || info == 31) {
+		return 0;
+	}
+	if (info > 27) {
+		return -1;
+	}
+	size_t length = (size_t) 1 << (info - 24);
+	if ((size_t) (cursor->end - cursor->pos) < length) {
+		return -1;
+	}
+	*argument = 0;
+	for (size_t i = 0; i < length; i++) {
+		*argument = (*argument << 8) | *cursor->pos++;
+	}
+	return 0;
+}
+
+static size_t write_head(uint8_t * out, unsigned int major, uint64_t argument) {
+	uint8_t head[9];
+	size_t length = 1;
+	if (argument < 24) {
+		head[0] = (uint8_t) (major << 5 | argument);
+	} else {
+		unsigned int bytes = (argument <= 0xFF) ? 1 : (argument <= 0xFFFF) ? 2 :
+				(argument <= 0xFFFFFFFF) ? 4 : 8;
+		head[0] = (uint8_t) (major << 5 | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+		for (unsigned int i = 0; i < bytes; i++) {
+			head[length++] = (uint8_t) (argument >> (8 * (bytes - 1 - i)));
+		}
+	}
+	if (out != NULL) {
+		memcpy(out, head, length);
+	}
+	return length;
+}
+
+// Copies one item to out with definite lengths only, just counts the bytes if out is NULL.
+// Returns the bytes written, 0 if the input is not well-formed.
+static size_t canonicalize(Cursor * cursor, uint8_t * out) {
+	unsigned int major;
+	uint64_t argument;
+	int indefinite;
+	const uint8_t * start = cursor->pos;
+	if (read_head(cursor, &major, &argument, &indefinite) != 0) {
+		return 0;
+	}
+
+	if (major == 4 && indefinite) {
+		// The definite head goes in front once the items are counted
+		uint8_t * items = (out != NULL) ? out + 9 : NULL;
+		size_t length = 0;
+		uint64_t count = 0;
+		while (cursor->pos < cursor->end && *cursor->pos != 0xFF) {
+			size_t item = canonicalize(cursor, (items != NULL) ? items + length : NULL);
+			if (item == 0) {
+				return 0;
+			}
+			length += item;
+			count++;
+		}
+		if (cursor->pos >= cursor->end) {
+			return 0;
+		}
+		cursor->pos++;
+		size_t head = write_head(out, 4, count);
+		if (out != NULL) {
+			memmove(out + head, items, length);
+		}
+		return head + length;
+	}
+	if (indefinite) {
+		return 0;	// the encoder opens nothing else with indefinite length
+	}
+	if (major == 7) {
+		// Simple values and floats are copied as they are, the value is in the head
+		size_t size = (size_t) (cursor->pos - start);
+		if (out != NULL) {
+			memcpy(out, start, size);
+		}
+		return size;
+	}
+
+	size_t length = write_head(out, major, argument);
+	switch (major) {
+	case 2:
+	case 3:
+		if ((uint64_t) (cursor->end - cursor->pos) < argument) {
+			return 0;
+		}
+		if (out != NULL) {
+			memcpy(out + length, cursor->pos, argument);
+		}
+		cursor->pos += argument;
+		return length + argument;
+	case 4:
+	case 5:
+	case 6: {
+		uint64_t items = (major == 4) ? argument : (major == 5) ? 2 * argument : 1;
+		for (uint64_t i = 0; i < items; i++) {
+			size_t item = canonicalize(cursor, (out != NULL) ? out + length : NULL);
+			if (item == 0) {
+				return 0;
+			}
+			length += item;
+		}
+		return length;
+	}
+	default:
+		return length;
+	}
+}
+
+// Canonical form of a complete output, 0 unless it is exactly one well-formed item
+static size_t canonicalize_all(const uint8_t * encoded, size_t length, uint8_t * out) {
+	Cursor cursor = {encoded, encoded + length};
+	size_t canonical_length = canonicalize(&cursor, out);
+	return (cursor.pos == cursor.end) ? canonical_length : 0;
+}
+
+static void setup_sizes(CaptureMode mode, ValueEncoding encoding, unsigned int sample_size,
+		unsigned int num_of_samples) {
+	mock_hal_init();
+	reset_fingerprinter_arena();
+	hadc1.Instance = ADC1;
+	hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
+	htim1.Instance = TIM1;
+	htim2.Instance = TIM2;
+	for (size_t i = 0; i < 2; i++) {
+		init_fingerprinter(&loads[i], (i == 0) ? "Load A" : "Load B", GPIOA, GPIO_PIN_0 << i,
+				GPIOA, GPIO_PIN_4 << i, &huart2, &htim1, &hadc1, sample_size, num_of_samples);
+		set_trigger_timer(&loads[i], &htim2, SAMPLE_RATE_HZ);
+		set_capture_mode(&loads[i], mode);
+		set_value_encoding(&loads[i], encoding);
+	}
+	mock_hal.complete_dma_on_start = 1;
+}
+
+static void setup(CaptureMode mode, ValueEncoding encoding) {
+	setup_sizes(mode, encoding, SAMPLE_SIZE, NUM_OF_SAMPLES);
+}
+
+static int skip_item(Cursor * cursor) {
+	return canonicalize(cursor, NULL) != 0 ? 0 : -1;
+}
+
+// delta-values byte string of the first series, NULL if there is none
+static const uint8_t * find_delta_values(const uint8_t * encoded, size_t length,
+		size_t * values_length) {
+	Cursor cursor = {encoded, encoded + length};
+	unsigned int major;
+	uint64_t argument;
+	int indefinite;
+
+	// AnalogMeasurement: version-tag, start-time, then the flat items of every series
+	if (read_head(&cursor, &major, &argument, &indefinite) != 0 || skip_item(&cursor) != 0 ||
+			skip_item(&cursor) != 0 || read_head(&cursor, &major, &argument, &indefinite) != 0) {
+		return NULL;
+	}
+	for (uint64_t item = 0; item < argument && cursor.pos < cursor.end; item++) {
+		if (*cursor.pos >> 5 != 5) {
+			if (skip_item(&cursor) != 0) {
+				return NULL;
+			}
+			continue;
+		}
+		uint64_t pairs;
+		read_head(&cursor, &major, &pairs, &indefinite);
+		for (uint64_t pair = 0; pair < pairs; pair++) {
+			uint64_t key;
+			if (read_head(&cursor, &major, &key, &indefinite) != 0) {
+				return NULL;
+			}
+			if (major == 0 && key == delta_values_map) {
+				if (read_head(&cursor, &major, &argument, &indefinite) != 0 || major != 2) {
+					return NULL;
+				}
+				*values_length = argument;
+				return cursor.pos;
+			}
+			if (skip_item(&cursor) != 0) {
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+// Encodes both ways and checks that the outputs decode to the same AnalogMeasurement
+static void check_round_trip(size_t count, const char * test) {
+	UsefulBufC direct = NULLUsefulBufC;
+	mock_hal_reset_counters();
+	QCBORError err = convert_to_cbor_direct(load_pointers, count,
+			(UsefulBuf){engine_buffer, sizeof(engine_buffer)}, &direct);
+	check(err == QCBOR_SUCCESS, test, "direct encoding failed");
+	if (err != QCBOR_SUCCESS) {
+		return;
+	}
+	check(mock_hal.uart_log_length == direct.len &&
+			memcmp(mock_hal.uart_log, direct.ptr, direct.len) == 0, test,
+			"direct encoder sent something else than it returned");
+	check(canonicalize_all(direct.ptr, direct.len, NULL) == direct.len, test,
+			"direct output not a single well-formed item with definite lengths");
+
+	size_t encoded_len = 0;
+	mock_hal_reset_counters();
+	err = convert_to_cbor_chunked(load_pointers, count, &encoded_len);
+	check(err == QCBOR_SUCCESS, test, "chunked encoding failed");
+	check(encoded_len == mock_hal.uart_log_length, test, "encoded_len differs from the bytes sent");
+	check(get_encoded_size_chunked(load_pointers, count) == encoded_len, test,
+			"get_encoded_size_chunked differs from the bytes sent");
+	memcpy(chunked, mock_hal.uart_log, mock_hal.uart_log_length);
+
+	size_t canonical_length = canonicalize_all(chunked, encoded_len, canonical);
+	check(canonical_length != 0, test, "chunked output not a single well-formed item");
+	check(canonical_length == direct.len && memcmp(canonical, direct.ptr, direct.len) == 0, test,
+			"chunked output decodes to another item than the direct one");
+}
+
+static void test_round_trip(CaptureMode mode, ValueEncoding encoding, const char * test) {
+	setup(mode, encoding);
+	get_fingerprint(&loads[0], 0);
+	check_round_trip(1, test);
+}
+
+static void test_round_trip_features(void) {
+	const char * test = "round trip of features";
+	setup(CAPTURE_POLLED, VALUES_INTEGERS);
+	set_rc_features(&loads[0], RC_FEATURES_WITH_RAW);
+	set_phase_timing(&loads[0], 1);
+	set_supply_correction(&loads[0], 1);
+	get_fingerprint(&loads[0], 0);
+	check_round_trip(1, test);
+}
+
+static void test_round_trip_statistics(void) {
+	const char * test = "round trip of statistics";
+	setup(CAPTURE_POLLED, VALUES_INTEGERS);
+	get_fingerprint_statistics(&loads[0], 0, 4);
+	check(loads[0].repetitions == 4, test, "statistics not captured");
+	check_round_trip(1, test);
+}
+
+static void test_round_trip_two_loads(void) {
+	const char * test = "round trip of two loads";
+	setup(CAPTURE_POLLED, VALUES_DELTA_VARINT);
+	get_fingerprint(&loads[0], 0);
+	get_fingerprint(&loads[1], 0);
+	check_round_trip(2, test);
+}
+
+static void test_direct_uart_error(void) {
+	const char * test = "direct UART error";
+	UsefulBufC direct = NULLUsefulBufC;
+	setup(CAPTURE_POLLED, VALUES_TYPED_ARRAY);
+	get_fingerprint(&loads[0], 0);
+
+	// The first slice fails, nothing else is tried
+	mock_hal_reset_counters();
+	mock_hal.uart_fail_at = 1;
+	QCBORError err = convert_to_cbor_direct(load_pointers, 1,
+			(UsefulBuf){engine_buffer, sizeof(engine_buffer)}, &direct);
+	check(err == CBOR_ERR_UART_TRANSMIT, test, "failed first slice not reported");
+	check(mock_hal.uart_transmits == 1, test, "transmitted on after the first slice failed");
+
+	// The output is longer than a slice, so a later one can fail as well
+	mock_hal_reset_counters();
+	mock_hal.uart_fail_at = 2;
+	err = convert_to_cbor_direct(load_pointers, 1,
+			(UsefulBuf){engine_buffer, sizeof(engine_buffer)}, &direct);
+	check(err == CBOR_ERR_UART_TRANSMIT, test, "failed second slice not reported");
+	check(direct.len > 256 && mock_hal.uart_transmits == 2, test,
+			"transmitted on after the second slice failed");
+	check(mock_hal.uart_log_length == 256, test, "first slice not sent whole");
+
+	// An EngineBuffer that is too small is reported and nothing is sent
+	mock_hal_reset_counters();
+	mock_hal.uart_fail_at = 0;
+	err = convert_to_cbor_direct(load_pointers, 1, (UsefulBuf){engine_buffer, 64}, &direct);
+	check(err == QCBOR_ERR_BUFFER_TOO_SMALL, test, "small EngineBuffer not reported");
+	check(mock_uart_contains("[ERROR] AnalogMeasurement does not fit into EngineBuffer"), test,
+			"small EngineBuffer not printed");
+	check(mock_hal.uart_transmits == 1, test, "CBOR sent from a small EngineBuffer");
+}
+
+static void test_chunked_uart_error(void) {
+	const char * test = "chunked UART error";
+	size_t encoded_len = 0;
+	setup(CAPTURE_POLLED, VALUES_TYPED_ARRAY);
+	get_fingerprint(&loads[0], 0);
+
+	mock_hal_reset_counters();
+	convert_to_cbor_chunked(load_pointers, 1, &encoded_len);
+	unsigned int transmits = mock_hal.uart_transmits;
+	check(transmits > 2, test, "output not sent in several windows");
+
+	// Whichever transmission fails, it is the last one and encoded_len counts what went out
+	for (unsigned int fail_at = 1; fail_at <= transmits; fail_at++) {
+		mock_hal_reset_counters();
+		mock_hal.uart_fail_at = fail_at;
+		QCBORError err = convert_to_cbor_chunked(load_pointers, 1, &encoded_len);
+		check(err == CBOR_ERR_UART_TRANSMIT, test, "failed transmission not reported");
+		check(mock_hal.uart_transmits == fail_at, test, "transmitted on after a failure");
+		check(encoded_len == mock_hal.uart_log_length, test,
+				"encoded_len differs from the bytes sent before the failure");
+	}
+}
+
+// The bound taken before the capture covers the output whatever the metadata turned out to be
+static void test_size_bound(CaptureMode mode, ValueEncoding encoding, const char * test) {
+	UsefulBufC direct = NULLUsefulBufC;
+	setup(mode, encoding);
+	set_phase_timing(&loads[0], 1);
+	size_t bound = get_encoded_size_bound(load_pointers, 1);
+	get_fingerprint(&loads[0], 0);
+	check(get_encoded_size_bound(load_pointers, 1) == bound, test, "bound depends on the capture");
+
+	for (size_t widest = 0; widest < 2; widest++) {
+		if (widest) {
+			// Metadata at the end of its range, as a stuck line or a slow clock would leave it
+			for (size_t sample = 0; sample < NUM_OF_SAMPLES; sample++) {
+				loads[0].settle_t[sample] = 0xFFFFFFFFUL;
+				loads[0].settle_timed_out[sample] = 1;
+				loads[0].delta_t[sample] = 0xFFFFFFFFUL;
+				loads[0].ts_data[sample] = 0xFFFF;
+				for (size_t mark = 0; mark < NUM_OF_PHASE_MARKS; mark++) {
+					loads[0].phase_t[sample * NUM_OF_PHASE_MARKS + mark] = 0x40000000UL * mark;
+				}
+			}
+			loads[0].capture_clock_hz = 0xFFFFFFFFUL;
+		}
+		size_t exact = get_encoded_size_exact(load_pointers, 1);
+		check(exact != 0 && exact <= bound, test, "exact size above the bound");
+
+		mock_hal_reset_counters();
+		QCBORError err = convert_to_cbor_direct(load_pointers, 1, (UsefulBuf){engine_buffer, bound},
+				&direct);
+		check(err == QCBOR_SUCCESS && direct.len == exact, test,
+				"output does not fit an EngineBuffer of the bound or differs from the exact size");
+	}
+}
+
+static void test_size_bound_statistics(void) {
+	const char * test = "size bound of statistics";
+	setup(CAPTURE_POLLED, VALUES_INTEGERS);
+	get_fingerprint_statistics(&loads[0], 0, 2);
+	size_t bound = get_encoded_size_bound(load_pointers, 1);
+
+	// More runs than a one byte head holds
+	get_fingerprint_statistics(&loads[0], 0, 300);
+	check(get_encoded_size_bound(load_pointers, 1) == bound, test, "bound depends on the runs");
+	size_t exact = get_encoded_size_exact(load_pointers, 1);
+	check(exact != 0 && exact <= bound, test, "exact size above the bound");
+}
+
+static void check_delta_values(const uint16_t * samples, size_t count, const uint8_t * expected,
+		size_t expected_length, const char * test) {
+	UsefulBufC direct = NULLUsefulBufC;
+	setup_sizes(CAPTURE_POLLED, VALUES_DELTA_VARINT, count, 1);
+	memcpy(loads[0].samples, samples, count * sizeof(uint16_t));
+
+	mock_hal_reset_counters();
+	QCBORError err = convert_to_cbor_direct(load_pointers, 1,
+			(UsefulBuf){engine_buffer, sizeof(engine_buffer)}, &direct);
+	check(err == QCBOR_SUCCESS, test, "direct encoding failed");
+	if (err != QCBOR_SUCCESS) {
+		return;
+	}
+	size_t length = 0;
+	const uint8_t * values = find_delta_values(direct.ptr, direct.len, &length);
+	check(values != NULL, test, "no delta-values in the output");
+	check(values != NULL && length == expected_length && memcmp(values, expected, length) == 0,
+			test, "delta-values bytes differ");
+
+	// The chunked encoder packs the same bytes window by window
+	check_round_trip(1, test);
+}
+
+static void test_delta_values(void) {
+	// First value 0, a jump to full scale, then two negative and one positive delta
+	static const uint16_t rising[] = {0, 4095, 4093, 4094};
+	static const uint8_t rising_bytes[] = {0x00, 0xFE, 0x3F, 0x03, 0x02};
+	check_delta_values(rising, 4, rising_bytes, sizeof(rising_bytes), "delta values 0 to 4095");
+
+	static const uint16_t falling[] = {4095, 0};
+	static const uint8_t falling_bytes[] = {0xFE, 0x3F, 0xFD, 0x3F};
+	check_delta_values(falling, 2, falling_bytes, sizeof(falling_bytes), "delta values 4095 to 0");
+
+	// A full halfword difference takes the longest varint
+	static const uint16_t widest[] = {0, 65535};
+	static const uint8_t widest_bytes[] = {0x00, 0xFE, 0xFF, 0x07};
+	check_delta_values(widest, 2, widest_bytes, sizeof(widest_bytes), "delta values 0 to 65535");
+
+	static const uint16_t single[] = {4095};
+	static const uint8_t single_bytes[] = {0xFE, 0x3F};
+	check_delta_values(single, 1, single_bytes, sizeof(single_bytes), "delta values of one sample");
+}
+
+int main(void) {
+	test_round_trip(CAPTURE_POLLED, VALUES_INTEGERS, "round trip of integers");
+	test_round_trip(CAPTURE_POLLED, VALUES_TYPED_ARRAY, "round trip of a typed array");
+	test_round_trip(CAPTURE_POLLED, VALUES_DELTA_VARINT, "round trip of delta varints");
+	test_round_trip(CAPTURE_TIMESTAMPED, VALUES_INTEGERS, "round trip of timestamps");
+	test_round_trip(CAPTURE_TIMER_TRIGGERED, VALUES_INTEGERS, "round trip of a triggered capture");
+	test_round_trip_features();
+	test_round_trip_statistics();
+	test_round_trip_two_loads();
+	test_direct_uart_error();
+	test_chunked_uart_error();
+	test_size_bound(CAPTURE_POLLED, VALUES_INTEGERS, "size bound of integers");
+	test_size_bound(CAPTURE_POLLED, VALUES_TYPED_ARRAY, "size bound of a typed array");
+	test_size_bound(CAPTURE_POLLED, VALUES_DELTA_VARINT, "size bound of delta varints");
+	test_size_bound(CAPTURE_TIMESTAMPED, VALUES_INTEGERS, "size bound of timestamps");
+	test_size_bound(CAPTURE_TIMER_TRIGGERED, VALUES_INTEGERS, "size bound of a triggered capture");
+	test_size_bound_statistics();
+	test_delta_values();
+
+	if (failures != 0) {
+		printf("cddlEncoderTest: %u checks failed\n", failures);
+		return 1;
+	}
+	printf("cddlEncoderTest: all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,211 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file fingerprinterAsyncTest.c
+* @brief Drives the asynchronous fingerprint API from a simulated SysTick and
+* DMA interrupt
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "halMock.h"
+#include "fingerprinter.h"
+
+#define SAMPLE_SIZE (8)
+#define NUM_OF_SAMPLES (3)
+
+// Upper bound of simulated milliseconds a capture may take
+#define MAX_TICKS (2000)
+
+static ADC_HandleTypeDef hadc1;
+static TIM_HandleTypeDef htim1;
+static TIM_HandleTypeDef htim2;
+static UART_HandleTypeDef huart2;
+
+static unsigned int failures = 0;
+static unsigned int completions = 0;
+static int completed_in_interrupt = 0;
+
+static void check(int condition, const char * test, const char * what) {
+	if (!condition) {
+		printf("FAIL %s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static void on_complete(Fingerprinter * fingerprint) {
+	completions++;
+	completed_in_interrupt |= mock_hal.in_interrupt;
+}
+
+static void setup(Fingerprinter * fingerprint) {
+	mock_hal_init();
+	reset_fingerprinter_arena();
+	hadc1.Instance = ADC1;
+	hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
+	htim1.Instance = TIM1;
+	htim2.Instance = TIM2;
+	init_fingerprinter(fingerprint, "Test Load", GPIOA, GPIO_PIN_0, GPIOA, GPIO_PIN_1,
+			&huart2, &htim1, &hadc1, SAMPLE_SIZE, NUM_OF_SAMPLES);
+	completions = 0;
+	completed_in_interrupt = 0;
+}
+
+// The main loop of a firmware using the API: SysTick and DMA fire, the thread polls
+static FingerprintState run(Fingerprinter * fingerprint, int complete_dma) {
+	FingerprintState state = poll_fingerprint_async(fingerprint);
+	for (unsigned int tick = 0; tick < MAX_TICKS &&
+			state != FINGERPRINT_DONE && state != FINGERPRINT_ERROR; tick++) {
+		mock_systick();
+		if (complete_dma && mock_hal.dma_adc != NULL) {
+			mock_complete_dma();
+		}
+		state = poll_fingerprint_async(fingerprint);
+	}
+	return state;
+}
+
+static void test_rejects_polled_modes(void) {
+	const char * test = "rejects polled modes";
+	Fingerprinter fingerprint;
+	setup(&fingerprint);
+
+	set_capture_mode(&fingerprint, CAPTURE_POLLED);
+	check(start_fingerprint_async(&fingerprint, 0, on_complete) != 0, test, "polled start accepted");
+	set_capture_mode(&fingerprint, CAPTURE_TIMESTAMPED);
+	check(start_fingerprint_async(&fingerprint, 0, on_complete) != 0, test,
+			"timestamped start accepted");
+	check(mock_uart_contains("[ERROR] asynchronous capture needs a DMA capture mode"), test,
+			"no error reported");
+	check(poll_fingerprint_async(&fingerprint) == FINGERPRINT_IDLE, test, "state changed");
+}
+
+static void test_interrupts_only_flag(void) {
+	const char * test = "interrupts only flag";
+	Fingerprinter fingerprint;
+	setup(&fingerprint);
+	set_capture_mode(&fingerprint, CAPTURE_DMA);
+
+	check(start_fingerprint_async(&fingerprint, 0, on_complete) == 0, test, "start failed");
+	mock_hal_reset_counters();
+
+	// Without a poll nothing but flags may change, however many interrupts fire
+	for (unsigned int tick = 0; tick < 10; tick++) {
+		mock_systick();
+	}
+	check(fingerprint.state == FINGERPRINT_DISCHARGE, test, "SysTick advanced the state");
+	check(mock_hal.injected_conversions == 0, test, "SysTick probed the lines");
+
+	// Settle both discharge phases, one probe per polled tick
+	while (fingerprint.state != FINGERPRINT_CAPTURE && mock_hal.tick < MAX_TICKS) {
+		mock_systick();
+		poll_fingerprint_async(&fingerprint);
+	}
+	check(fingerprint.state == FINGERPRINT_CAPTURE, test, "capture not started");
+	check(mock_hal.injected_conversions == 2 * 3, test, "not three probes per settle phase");
+
+	mock_complete_dma();
+	check(fingerprint.state == FINGERPRINT_CAPTURE, test, "DMA interrupt advanced the state");
+	check(mock_hal.dma_adc != NULL, test, "DMA interrupt stopped the transfer");
+	check(fingerprint.async_sample == 0, test, "DMA interrupt finished the sample");
+
+	check(poll_fingerprint_async(&fingerprint) == FINGERPRINT_DISCHARGE, test,
+			"poll did not start the next sample");
+	check(mock_hal.dma_adc == NULL && mock_hal.dma_stops == 1, test, "poll did not stop the DMA");
+	check(fingerprint.async_sample == 1, test, "sample not finished");
+	check(mock_hal.calls_in_interrupt == 0, test, "HAL called from an interrupt handler");
+	check(run(&fingerprint, 1) == FINGERPRINT_DONE, test, "capture not done");
+}
+
+static void test_completes_capture(void) {
+	const char * test = "completes capture";
+	Fingerprinter fingerprint;
+	setup(&fingerprint);
+	set_capture_mode(&fingerprint, CAPTURE_DMA);
+
+	check(start_fingerprint_async(&fingerprint, 0, on_complete) == 0, test, "start failed");
+	check(run(&fingerprint, 1) == FINGERPRINT_DONE, test, "capture not done");
+	check(completions == 1, test, "callback not called once");
+	check(!completed_in_interrupt, test, "callback called from an interrupt handler");
+	check(mock_hal.calls_in_interrupt == 0, test, "HAL called from an interrupt handler");
+	check(mock_hal.dma_starts == NUM_OF_SAMPLES && mock_hal.dma_stops == NUM_OF_SAMPLES, test,
+			"not one DMA transfer per sample");
+
+	// The simulated ADC counts up, so every sample holds the next SAMPLE_SIZE values
+	int ramp = 1;
+	for (size_t i = 0; i < NUM_OF_SAMPLES * SAMPLE_SIZE; i++) {
+		ramp &= fingerprint.samples[i] == i;
+	}
+	check(ramp, test, "samples not taken from the DMA buffers");
+	for (size_t sample = 0; sample < NUM_OF_SAMPLES; sample++) {
+		check(fingerprint.settle_t[sample] >= 2 * 3 * 1000, test, "settle time shorter than the probes");
+		check(fingerprint.vrefint[sample] == mock_hal.vrefint, test, "VREFINT not recorded");
+		check(fingerprint.ts_data[sample] == mock_hal.temperature, test, "temperature not recorded");
+	}
+	check(fingerprint.delta_t_hz == 1000000, test, "delta_t not in microseconds");
+	check(poll_fingerprint_async(&fingerprint) == FINGERPRINT_DONE, test, "state left DONE");
+}
+
+static void test_settle_timeout(void) {
+	const char * test = "settle timeout";
+	Fingerprinter fingerprint;
+	setup(&fingerprint);
+	set_capture_mode(&fingerprint, CAPTURE_DMA);
+	set_settle_detection(&fingerprint, 16, 20);
+
+	// Lines that never discharge still get captured once settle_timeout_ms ran out
+	mock_hal.line_level = 4000;
+	check(start_fingerprint_async(&fingerprint, 0, on_complete) == 0, test, "start failed");
+	while (fingerprint.state != FINGERPRINT_CAPTURE && mock_hal.tick < MAX_TICKS) {
+		mock_systick();
+		poll_fingerprint_async(&fingerprint);
+	}
+	check(mock_hal.tick >= 2 * 20 && mock_hal.tick <= 2 * 21, test,
+			"settle phases not bounded by the timeout");
+	check(run(&fingerprint, 1) == FINGERPRINT_DONE, test, "capture not done");
+}
+
+static void test_capture_timeout(void) {
+	const char * test = "capture timeout";
+	Fingerprinter fingerprint;
+	setup(&fingerprint);
+	set_capture_mode(&fingerprint, CAPTURE_DMA);
+
+	// A DMA transfer that never completes ends the capture instead of hanging
+	check(start_fingerprint_async(&fingerprint, 0, on_complete) == 0, test, "start failed");
+	check(run(&fingerprint, 0) == FINGERPRINT_ERROR, test, "capture did not fail");
+	check(mock_uart_contains("[ERROR] ADC DMA capture timed out"), test, "no error reported");
+	check(mock_hal.dma_adc == NULL, test, "DMA left running");
+	check(completions == 1 && !completed_in_interrupt, test, "callback not called once from thread");
+
+	// The next capture may start right away
+	mock_hal_reset_counters();
+	check(start_fingerprint_async(&fingerprint, 0, on_complete) == 0, test, "restart failed");
+	check(run(&fingerprint, 1) == FINGERPRINT_DONE, test, "restarted capture not done");
+}
+
+int main(void) {
+	test_rejects_polled_modes();
+	test_interrupts_only_flag();
+	test_completes_capture();
+	test_settle_timeout();
+	test_capture_timeout();
+
+	if (failures != 0) {
+		printf("fingerprinterAsyncTest: %u checks failed\n", failures);
+		return 1;
+	}
+	printf("fingerprinterAsyncTest: all checks passed\n");
+	return 0;
+}
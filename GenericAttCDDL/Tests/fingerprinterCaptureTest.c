@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file fingerprinterCaptureTest.c
+* @brief Compares the DMA backed captures of get_fingerprint with the polled one
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "halMock.h"
+#include "fingerprinter.h"
+
+#define SAMPLE_SIZE (16)
+#define NUM_OF_SAMPLES (4)
+#define SAMPLE_RATE_HZ (100000)
+
+static ADC_HandleTypeDef hadc1;
+static TIM_HandleTypeDef htim1;
+static TIM_HandleTypeDef htim2;
+static UART_HandleTypeDef huart2;
+
+static unsigned int failures = 0;
+
+static void check(int condition, const char * test, const char * what) {
+	if (!condition) {
+		printf("FAIL %s: %s\n", test, what);
+		failures++;
+	}
+}
+
+static void setup(Fingerprinter * fingerprint, CaptureMode mode) {
+	mock_hal_init();
+	reset_fingerprinter_arena();
+	hadc1.Instance = ADC1;
+	hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
+	htim1.Instance = TIM1;
+	htim2.Instance = TIM2;
+	init_fingerprinter(fingerprint, "Test Load", GPIOA, GPIO_PIN_0, GPIOA, GPIO_PIN_1,
+			&huart2, &htim1, &hadc1, SAMPLE_SIZE, NUM_OF_SAMPLES);
+	set_trigger_timer(fingerprint, &htim2, SAMPLE_RATE_HZ);
+	set_capture_mode(fingerprint, mode);
+
+	// Blocking captures see their DMA transfer complete right away
+	mock_hal.complete_dma_on_start = 1;
+}
+
+static void test_dma_matches_polled(CaptureMode mode, const char * test) {
+	Fingerprinter polled;
+	Fingerprinter dma;
+	static uint16_t polled_samples[NUM_OF_SAMPLES * SAMPLE_SIZE];
+
+	// Both see the same conversions of the simulated ADC, one by one or in bursts
+	setup(&polled, CAPTURE_POLLED);
+	get_fingerprint(&polled, 0);
+	check(mock_hal.polled_conversions == NUM_OF_SAMPLES * SAMPLE_SIZE, test,
+			"polled capture did not convert every sample");
+	check(mock_hal.dma_starts == 0, test, "polled capture used DMA");
+	check(hadc1.Init.ContinuousConvMode == DISABLE, test, "polled capture converts continuously");
+	memcpy(polled_samples, polled.samples, sizeof(polled_samples));
+
+	setup(&dma, mode);
+	get_fingerprint(&dma, 0);
+	check(mock_hal.polled_conversions == 0, test, "DMA capture polled");
+	check(mock_hal.dma_starts == NUM_OF_SAMPLES && mock_hal.dma_stops == NUM_OF_SAMPLES, test,
+			"not one stopped DMA burst per sample");
+	check(mock_hal.dma_length == SAMPLE_SIZE, test, "DMA burst not sample_size long");
+	check(memcmp(polled_samples, dma.samples, sizeof(polled_samples)) == 0, test,
+			"DMA samples differ from the polled ones");
+	check(mock_hal.uart_log_length == 0, test, "DMA capture reported an error");
+
+	if (mode == CAPTURE_TIMER_TRIGGERED) {
+		check(hadc1.Init.ContinuousConvMode == DISABLE, test, "triggered capture converts continuously");
+		check(hadc1.Init.ExternalTrigConv == ADC_EXTERNALTRIG_T2_TRGO, test, "ADC not triggered by TIM2");
+		check(dma.trigger_rate_hz == SAMPLE_RATE_HZ, test, "trigger rate not achieved");
+		check(!(TIM2->CR1 & TIM_CR1_CEN), test, "trigger timer left running");
+	} else {
+		check(hadc1.Init.ContinuousConvMode == ENABLE, test, "DMA capture not continuous");
+		check(hadc1.Init.ExternalTrigConv == ADC_SOFTWARE_START, test, "DMA capture not software started");
+	}
+}
+
+static void test_dma_timeout(void) {
+	const char * test = "DMA timeout";
+	Fingerprinter fingerprint;
+	setup(&fingerprint, CAPTURE_DMA);
+
+	// A transfer that never completes ends once the capture timeout ran out
+	mock_hal.complete_dma_on_start = 0;
+	mock_hal.ticks_per_get_tick = 1;
+	get_fingerprint(&fingerprint, 0);
+	check(mock_uart_contains("[ERROR] ADC DMA capture timed out"), test, "no error reported");
+	check(mock_hal.dma_starts == NUM_OF_SAMPLES && mock_hal.dma_stops == NUM_OF_SAMPLES, test,
+			"timed out DMA left running");
+}
+
+static void test_timestamps_across_wrap(void) {
+	const char * test = "timestamps across wrap";
+	Fingerprinter fingerprint;
+	setup(&fingerprint, CAPTURE_TIMESTAMPED);
+
+	// Each conversion takes 30000 ticks, so the 16-bit timer wraps several times a sample
+	mock_hal.timer_ticks_per_conversion = 30000;
+	get_fingerprint(&fingerprint, 0);
+	for (size_t sample = 0; sample < NUM_OF_SAMPLES; sample++) {
+		const unsigned long * sample_t = &fingerprint.sample_t[sample * SAMPLE_SIZE];
+		for (size_t i = 0; i < SAMPLE_SIZE; i++) {
+			check(sample_t[i] == 30000UL * (i + 1), test, "timestamp not extended over the wrap");
+		}
+		check(fingerprint.delta_t[sample] == 30000UL * SAMPLE_SIZE, test,
+				"capture time not extended over the wrap");
+	}
+}
+
+static size_t arena_free_in_block = 0;
+
+static void count_block(Fingerprinter * fingerprint, const uint16_t * block, size_t length,
+		size_t block_index) {
+	arena_free_in_block = get_fingerprinter_arena_free();
+}
+
+static void enable_phase_timing_in_block(Fingerprinter * fingerprint, const uint16_t * block,
+		size_t length, size_t block_index) {
+	set_phase_timing(fingerprint, 1);
+	arena_free_in_block = get_fingerprinter_arena_free();
+}
+
+static void test_stream_releases_ring(void) {
+	const char * test = "stream releases ring";
+	Fingerprinter fingerprint;
+	setup(&fingerprint, CAPTURE_TIMER_TRIGGERED);
+
+	// Both ring halves complete at once, enough for two blocks
+	size_t arena_free = get_fingerprinter_arena_free();
+	check(get_fingerprint_stream(&fingerprint, 0, 2, count_block) == 0, test, "stream failed");
+	check(arena_free_in_block < arena_free, test, "ring not allocated from the arena");
+	check(get_fingerprinter_arena_free() == arena_free, test, "ring not given back");
+
+	// An allocation behind the ring must survive the end of the stream
+	check(get_fingerprint_stream(&fingerprint, 0, 2, enable_phase_timing_in_block) == 0, test,
+			"stream failed");
+	check(fingerprint.phase_t != NULL, test, "phase timing not enabled");
+	check(get_fingerprinter_arena_free() == arena_free_in_block, test,
+			"rewind released an allocation made during the stream");
+	check(mock_uart_contains("[ERROR] arena allocation during capture"), test, "kept ring not reported");
+}
+
+int main(void) {
+	test_dma_matches_polled(CAPTURE_DMA, "DMA matches polled");
+	test_dma_matches_polled(CAPTURE_TIMER_TRIGGERED, "triggered DMA matches polled");
+	test_dma_timeout();
+	test_timestamps_across_wrap();
+	test_stream_releases_ring();
+
+	if (failures != 0) {
+		printf("fingerprinterCaptureTest: %u checks failed\n", failures);
+		return 1;
+	}
+	printf("fingerprinterCaptureTest: all checks passed\n");
+	return 0;
+}
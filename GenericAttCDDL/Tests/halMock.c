@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file halMock.c
+* @brief Host implementation of the HAL functions the fingerprinter calls
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#include "halMock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "fingerprinter.h"
+#include "adcCalibration.h"
+
+MockHal mock_hal;
+
+uint32_t SystemCoreClock = 16000000;
+
+// Device address ranges the fingerprinter reads or writes without a handle
+static const struct {
+	uintptr_t base;
+	size_t size;
+} register_blocks[] = {
+	{0x1FFF7000, 0x1000},	// VREFINT and temperature sensor calibration values
+	{PERIPH_BASE, 0x10061000},	// APB, AHB1 and AHB2 peripherals up to the ADC
+	{0xE0000000, 0x100000},	// DWT and CoreDebug
+};
+
+static void map_register_blocks(void) {
+	static int mapped = 0;
+	if (mapped) {
+		return;
+	}
+	for (size_t i = 0; i < sizeof(register_blocks) / sizeof(register_blocks[0]); i++) {
+		void * block = mmap((void *) register_blocks[i].base, register_blocks[i].size,
+				PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE |
+				MAP_NORESERVE, -1, 0);
+		if (block != (void *) register_blocks[i].base) {
+			fprintf(stderr, "cannot map registers at 0x%08lx\n",
+					(unsigned long) register_blocks[i].base);
+			exit(2);
+		}
+	}
+	mapped = 1;
+}
+
+static void hal_call(void) {
+	// Interrupt handlers are expected to leave all HAL work to thread context
+	if (mock_hal.in_interrupt) {
+		mock_hal.calls_in_interrupt++;
+	}
+}
+
+void mock_hal_init(void) {
+	map_register_blocks();
+	memset(&mock_hal, 0, sizeof(mock_hal));
+	mock_hal.vrefint = 1655;
+	mock_hal.temperature = 1100;
+	*VREFINT_CAL_ADDR = 1655;
+	*TEMPSENSOR_CAL1_ADDR = 1035;
+	*TEMPSENSOR_CAL2_ADDR = 1375;
+	TIM1->PSC = 16 - 1;	// microseconds at 16 MHz, as MX_TIM1_Init
+	TIM1->ARR = 0xFFFF;
+}
+
+void mock_hal_reset_counters(void) {
+	mock_hal.dma_starts = 0;
+	mock_hal.dma_stops = 0;
+	mock_hal.polled_conversions = 0;
+	mock_hal.injected_conversions = 0;
+	mock_hal.calls_in_interrupt = 0;
+	mock_hal.uart_transmits = 0;
+	mock_hal.uart_log_length = 0;
+	mock_hal.uart_log[0] = '\0';
+}
+
+void mock_systick(void) {
+	mock_hal.tick++;
+	TIM1->CNT = (TIM1->CNT + 1000) % (TIM1->ARR + 1);
+
+	mock_hal.in_interrupt = 1;
+	fingerprinter_tick();
+	mock_hal.in_interrupt = 0;
+}
+
+static void fill_dma_buffer(void) {
+	for (size_t i = 0; i < mock_hal.dma_length; i++) {
+		mock_hal.dma_buffer[i] = mock_hal.next_value++;
+	}
+}
+
+void mock_complete_dma(void) {
+	if (mock_hal.dma_adc == NULL) {
+		return;
+	}
+	fill_dma_buffer();
+
+	mock_hal.in_interrupt = 1;
+	HAL_ADC_ConvHalfCpltCallback(mock_hal.dma_adc);
+	HAL_ADC_ConvCpltCallback(mock_hal.dma_adc);
+	mock_hal.in_interrupt = 0;
+}
+
+int mock_uart_contains(const char * text) {
+	return strstr(mock_hal.uart_log, text) != NULL;
+}
+
+uint32_t HAL_GetTick(void) {
+	mock_hal.tick += mock_hal.ticks_per_get_tick;
+	return mock_hal.tick;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size,
+		uint32_t Timeout) {
+	hal_call();
+	// A failed transmission sends nothing
+	if (++mock_hal.uart_transmits == mock_hal.uart_fail_at) {
+		return HAL_ERROR;
+	}
+	size_t free_space = MOCK_UART_LOG_SIZE - 1 - mock_hal.uart_log_length;
+	size_t length = (Size < free_space) ? Size : free_space;
+	memcpy(&mock_hal.uart_log[mock_hal.uart_log_length], pData, length);
+	mock_hal.uart_log_length += length;
+	mock_hal.uart_log[mock_hal.uart_log_length] = '\0';
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim) {
+	hal_call();
+	htim->Instance->CR1 |= TIM_CR1_CEN;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim) {
+	hal_call();
+	htim->Instance->CR1 &= ~TIM_CR1_CEN;
+	return HAL_OK;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init) {
+	hal_call();
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+	hal_call();
+	if (PinState == GPIO_PIN_SET) {
+		GPIOx->ODR |= GPIO_Pin;
+	} else {
+		GPIOx->ODR &= ~(uint32_t) GPIO_Pin;
+	}
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void) {
+	return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+	return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void) {
+	return SystemCoreClock;
+}
+
+void HAL_RCC_GetClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t *pFLatency) {
+	memset(RCC_ClkInitStruct, 0, sizeof(*RCC_ClkInitStruct));
+	RCC_ClkInitStruct->AHBCLKDivider = RCC_SYSCLK_DIV1;
+	RCC_ClkInitStruct->APB1CLKDivider = RCC_HCLK_DIV1;
+	RCC_ClkInitStruct->APB2CLKDivider = RCC_HCLK_DIV1;
+	*pFLatency = FLASH_LATENCY_0;
+}
+
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef *hadc) {
+	hal_call();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_ConfigChannel(ADC_HandleTypeDef *hadc,
+		const ADC_ChannelConfTypeDef *pConfig) {
+	hal_call();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADCEx_InjectedConfigChannel(ADC_HandleTypeDef *hadc,
+		const ADC_InjectionConfTypeDef *pConfigInjected) {
+	hal_call();
+	MODIFY_REG(hadc->Instance->JSQR, ADC_JSQR_JL,
+			(pConfigInjected->InjectedNbrOfConversion - 1) << ADC_JSQR_JL_Pos);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef *hadc) {
+	hal_call();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop(ADC_HandleTypeDef *hadc) {
+	hal_call();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef *hadc, uint32_t Timeout) {
+	hal_call();
+	TIM1->CNT = (TIM1->CNT + mock_hal.timer_ticks_per_conversion) % (TIM1->ARR + 1);
+	return HAL_OK;
+}
+
+uint32_t HAL_ADC_GetValue(const ADC_HandleTypeDef *hadc) {
+	hal_call();
+	mock_hal.polled_conversions++;
+	return mock_hal.next_value++;
+}
+
+HAL_StatusTypeDef HAL_ADCEx_InjectedStart(ADC_HandleTypeDef *hadc) {
+	hal_call();
+	mock_hal.injected_conversions++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADCEx_InjectedStop(ADC_HandleTypeDef *hadc) {
+	hal_call();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADCEx_InjectedPollForConversion(ADC_HandleTypeDef *hadc, uint32_t Timeout) {
+	hal_call();
+	return HAL_OK;
+}
+
+uint32_t HAL_ADCEx_InjectedGetValue(const ADC_HandleTypeDef *hadc, uint32_t InjectedRank) {
+	static const uint32_t ranks[] = {
+		ADC_INJECTED_RANK_1, ADC_INJECTED_RANK_2, ADC_INJECTED_RANK_3, ADC_INJECTED_RANK_4,
+	};
+	uint32_t last = (hadc->Instance->JSQR & ADC_JSQR_JL) >> ADC_JSQR_JL_Pos;
+	hal_call();
+
+	// A single rank is the temperature sensor, otherwise VREFINT follows the probed lines
+	if (last == 0) {
+		return mock_hal.temperature;
+	}
+	if (InjectedRank == ranks[last]) {
+		return mock_hal.vrefint;
+	}
+	return mock_hal.line_level;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef *hadc, uint32_t *pData, uint32_t Length) {
+	hal_call();
+	if (mock_hal.dma_adc != NULL) {
+		return HAL_BUSY;
+	}
+	mock_hal.dma_adc = hadc;
+	mock_hal.dma_buffer = (uint16_t *) pData;	// the ADC DMA channel transfers halfwords
+	mock_hal.dma_length = Length;
+	mock_hal.dma_starts++;
+	if (mock_hal.complete_dma_on_start) {
+		mock_complete_dma();
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef *hadc) {
+	hal_call();
+	if (mock_hal.dma_adc == hadc) {
+		mock_hal.dma_adc = NULL;
+		mock_hal.dma_stops++;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma) {
+	hal_call();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_DeInit(DMA_HandleTypeDef *hdma) {
+	hal_call();
+	return HAL_OK;
+}
+
+int maintain_adc_calibration(void * adc) {
+	return 0;
+}
+
+uint32_t get_adc_calibration_factor(void) {
+	return 0x40;
+}
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file halMock.h
+* @brief Host implementation of the HAL functions the fingerprinter calls, with
+* a simulated SysTick, ADC and DMA
+*
+* The register blocks the fingerprinter touches directly (GPIO, timers, ADC, DWT
+* and the calibration values in system memory) are mapped at their device
+* addresses, so the device headers can be used unchanged.
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#ifndef HALMOCK_H_
+#define HALMOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+#define MOCK_UART_LOG_SIZE (16384)
+
+typedef struct {
+	uint32_t tick;	// HAL_GetTick
+	uint32_t ticks_per_get_tick;	// added by every HAL_GetTick, 0 if only mock_systick advances time
+	uint16_t line_level;	// injected conversion of every probed line
+	uint16_t vrefint;	// injected conversion of VREFINT
+	uint16_t temperature;	// injected conversion of the temperature sensor
+	uint16_t next_value;	// regular conversion returned next, counts up
+	uint32_t timer_ticks_per_conversion;	// added to the microsecond timer by every polled conversion
+	int complete_dma_on_start;	// blocking captures: HAL_ADC_Start_DMA finishes the transfer at once
+	ADC_HandleTypeDef * dma_adc;	// ADC of the running DMA transfer, NULL if none
+	uint16_t * dma_buffer;
+	size_t dma_length;
+	unsigned int dma_starts;
+	unsigned int dma_stops;
+	unsigned int polled_conversions;
+	unsigned int injected_conversions;
+	int in_interrupt;	// set while a simulated interrupt handler runs
+	unsigned int calls_in_interrupt;	// HAL calls made by an interrupt handler
+	unsigned int uart_transmits;	// HAL_UART_Transmit calls, failed ones included
+	unsigned int uart_fail_at;	// HAL_UART_Transmit call, counted from 1, that fails, 0 for none
+	char uart_log[MOCK_UART_LOG_SIZE];	// everything transmitted, binary output included
+	size_t uart_log_length;
+} MockHal;
+
+extern MockHal mock_hal;
+
+// Maps the register blocks and resets the simulation, call before anything else
+void mock_hal_init(void);
+
+// Clears the counters and the UART log, keeps time running
+void mock_hal_reset_counters(void);
+
+// One SysTick interrupt: 1 ms on HAL_GetTick and on the microsecond timer, then fingerprinter_tick
+void mock_systick(void);
+
+// The DMA transfer complete interrupt: fills the running transfer and calls HAL_ADC_ConvCpltCallback
+void mock_complete_dma(void);
+
+// Nonzero if the UART output contains text
+int mock_uart_contains(const char * text);
+
+#endif /* HALMOCK_H_ */
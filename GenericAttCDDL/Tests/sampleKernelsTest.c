@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*****************************************************************************
+* Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+* All rights reserved.
+****************************************************************************/
+
+/**
+* @file sampleKernelsTest.c
+* @brief Checks the SIMD sample kernels against their portable references
+*
+* @copyright Copyright 2024, Fraunhofer Institute for Secure Information
+* Technology SIT. All rights reserved.
+*
+* @license BSD 3-Clause "New" or "Revised" License (SPDX-License-Identifier:
+* BSD-3-Clause).
+*/
+
+#include <sampleKernels.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LENGTH (67)
+
+// Edge values of 12 bit conversions and of full halfwords, such as ensemble sums
+static const uint16_t edge_values[] = {0x0000, 0x0001, 0x0FFF, 0x1000, 0x7FFF, 0x8000, 0xFFFE, 0xFFFF};
+
+#define NUM_OF_EDGE_VALUES (sizeof(edge_values) / sizeof(edge_values[0]))
+
+static unsigned int failures = 0;
+
+static void check(int condition, const char * kernel, const char * fill, size_t offset,
+		size_t length) {
+	if (!condition) {
+		printf("FAIL %s with %s samples, offset %zu, length %zu\n", kernel, fill, offset, length);
+		failures++;
+	}
+}
+
+static void fill_samples(uint16_t * samples, size_t length, unsigned int fill) {
+	for (size_t i = 0; i < length; i++) {
+		if (fill < NUM_OF_EDGE_VALUES) {
+			samples[i] = edge_values[fill];
+		} else if (fill == NUM_OF_EDGE_VALUES) {
+			samples[i] = edge_values[i % NUM_OF_EDGE_VALUES];
+		} else {
+			samples[i] = (uint16_t) rand();
+		}
+	}
+}
+
+static void check_sums(const uint16_t * a, const char * fill, size_t offset, size_t length) {
+	// The sums are only defined for 12 bit conversions, the offset keeps the pair alignment
+	uint16_t conversions[MAX_LENGTH + 1];
+	uint16_t * c = &conversions[offset];
+	for (size_t i = 0; i < length; i++) {
+		c[i] = a[i] & 0x0FFF;
+	}
+	check(kernel_sum_u16(c, length) == kernel_sum_u16_ref(c, length),
+			"kernel_sum_u16", fill, offset, length);
+	check(kernel_sum_squares_u16(c, length) == kernel_sum_squares_u16_ref(c, length),
+			"kernel_sum_squares_u16", fill, offset, length);
+}
+
+static void check_kernels(const uint16_t * a, const uint16_t * b, const char * fill,
+		size_t offset, size_t length) {
+	check_sums(a, fill, offset, length);
+
+	uint16_t accumulator[MAX_LENGTH];
+	uint16_t accumulator_ref[MAX_LENGTH];
+	memcpy(accumulator, b, length * sizeof(uint16_t));
+	memcpy(accumulator_ref, b, length * sizeof(uint16_t));
+	kernel_accumulate_u16(accumulator, a, length);
+	kernel_accumulate_u16_ref(accumulator_ref, a, length);
+	check(memcmp(accumulator, accumulator_ref, length * sizeof(uint16_t)) == 0,
+			"kernel_accumulate_u16", fill, offset, length);
+
+	for (unsigned int shift = 0; shift <= 8; shift += 4) {
+		uint16_t average[MAX_LENGTH];
+		uint16_t average_ref[MAX_LENGTH];
+		kernel_average_u16(average, a, length, shift);
+		kernel_average_u16_ref(average_ref, a, length, shift);
+		check(memcmp(average, average_ref, length * sizeof(uint16_t)) == 0,
+				"kernel_average_u16", fill, offset, length);
+	}
+
+	int16_t difference[MAX_LENGTH];
+	int16_t difference_ref[MAX_LENGTH];
+	kernel_subtract_u16(difference, a, b, length);
+	kernel_subtract_u16_ref(difference_ref, a, b, length);
+	check(memcmp(difference, difference_ref, length * sizeof(int16_t)) == 0,
+			"kernel_subtract_u16", fill, offset, length);
+
+	if (length > 0) {
+		kernel_first_difference_u16(difference, a, length);
+		kernel_first_difference_u16_ref(difference_ref, a, length);
+		check(memcmp(difference, difference_ref, (length - 1) * sizeof(int16_t)) == 0,
+				"kernel_first_difference_u16", fill, offset, length);
+	}
+}
+
+int main(void) {
+	// One sample of slack in front, so odd offsets exercise unaligned pair loads
+	static uint16_t a[MAX_LENGTH + 1];
+	static uint16_t b[MAX_LENGTH + 1];
+	char fill_name[16];
+
+	srand(1);
+	for (unsigned int fill = 0; fill <= NUM_OF_EDGE_VALUES + 1; fill++) {
+		if (fill < NUM_OF_EDGE_VALUES) {
+			snprintf(fill_name, sizeof(fill_name), "0x%04X", edge_values[fill]);
+		} else {
+			snprintf(fill_name, sizeof(fill_name), fill == NUM_OF_EDGE_VALUES ? "edge" : "random");
+		}
+		for (size_t offset = 0; offset < 2; offset++) {
+			for (size_t length = 0; length + offset <= MAX_LENGTH; length++) {
+				fill_samples(&a[offset], length, fill);
+				fill_samples(&b[offset], length, NUM_OF_EDGE_VALUES + 1);
+				check_kernels(&a[offset], &b[offset], fill_name, offset, length);
+			}
+		}
+	}
+
+	if (failures != 0) {
+		printf("sampleKernelsTest: %u checks failed\n", failures);
+		return 1;
+	}
+	printf("sampleKernelsTest: all checks passed\n");
+	return 0;
+}
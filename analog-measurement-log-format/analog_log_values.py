@@ -0,0 +1,82 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# ------------------------------------------------------------------------------
+# Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+# All rights reserved.
+# ------------------------------------------------------------------------------
+# Decodes the values of a RegularMeasurementSeries of analog-log-format.cddl,
+# whichever of values, typed-values or delta-values carries them.
+#
+# Works on the maps a generic CBOR decoder returns, e.g. cbor2:
+#
+#     import cbor2
+#     log = cbor2.loads(data)
+#     regular_series_values(regular_series(log)[0])  # the first series
+# ------------------------------------------------------------------------------
+
+import sys
+from array import array
+
+VALUES = 0
+TYPED_VALUES = 4
+DELTA_VALUES = 5
+
+TYPED_ARRAY_UINT16_LE_TAG = 69
+
+
+def decode_uint16_le(data):
+    """Samples of a typed-values byte string, copied in one go."""
+    samples = array('H')
+    samples.frombytes(bytes(data))
+    if sys.byteorder != 'little':
+        samples.byteswap()
+    return samples.tolist()
+
+
+def decode_delta_varints(data):
+    """Samples of a delta-values byte string: zigzag LEB128 varints of the
+    first value and of each difference to the previous value."""
+    samples = []
+    value = 0
+    zigzag = 0
+    shift = 0
+    for byte in bytes(data):
+        zigzag |= (byte & 0x7F) << shift
+        shift += 7
+        if byte & 0x80:
+            continue
+        value += (zigzag >> 1) ^ -(zigzag & 1)
+        samples.append(value)
+        zigzag = 0
+        shift = 0
+    if shift != 0:
+        raise ValueError('delta-values ends inside a varint')
+    return samples
+
+
+def regular_series(log):
+    """RegularMeasurementSeries maps of a decoded AnalogMeasurement, in order.
+
+    The items of every MeasurementSeries follow each other in the measurements
+    array, and env-params and start-time are optional, so a series has no fixed
+    index. Its map is recognised by the key that carries its sample values."""
+    return [item for item in log[2] if isinstance(item, dict) and
+            any(key in item for key in (VALUES, TYPED_VALUES, DELTA_VALUES))]
+
+
+def regular_series_values(series):
+    """List of values of one RegularMeasurementSeries map."""
+    if VALUES in series:
+        return list(series[VALUES])
+    if TYPED_VALUES in series:
+        typed = series[TYPED_VALUES]
+        # Decoders without typed array support hand over the tag itself
+        if hasattr(typed, 'tag'):
+            if typed.tag != TYPED_ARRAY_UINT16_LE_TAG:
+                raise ValueError(f'unsupported typed array tag {typed.tag}')
+            typed = typed.value
+        if isinstance(typed, (bytes, bytearray, memoryview)):
+            return decode_uint16_le(typed)
+        return list(typed)
+    if DELTA_VALUES in series:
+        return decode_delta_varints(series[DELTA_VALUES])
+    raise ValueError('RegularMeasurementSeries without values')
@@ -0,0 +1,108 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# ------------------------------------------------------------------------------
+# Copyright 2024, Fraunhofer Institute for Secure Information Technology SIT.
+# All rights reserved.
+# ------------------------------------------------------------------------------
+# Round trips samples through the three RegularMeasurementSeries encodings the
+# firmware emits and back through analog_log_values.
+#
+#     python3 -m unittest test_analog_log_values
+# ------------------------------------------------------------------------------
+
+import struct
+import unittest
+from collections import namedtuple
+
+from analog_log_values import (DELTA_VALUES, TYPED_ARRAY_UINT16_LE_TAG,
+                               TYPED_VALUES, VALUES, decode_delta_varints,
+                               regular_series, regular_series_values)
+
+# What a CBOR decoder without typed array support returns for a tag
+Tag = namedtuple('Tag', 'tag value')
+
+# A rising RC curve followed by a drop, so deltas are positive and negative
+SAMPLES = [0, 1, 130, 4095, 4094, 2000, 2000, 0, 64, 63, 8255, 65535, 0]
+
+
+def encode_uint16_le(samples):
+    """Typed-values byte string as packed by the encoder."""
+    return struct.pack(f'<{len(samples)}H', *samples)
+
+
+def encode_delta_varints(samples):
+    """Delta-values byte string as packed by packDeltaVarints."""
+    data = bytearray()
+    previous = 0
+    for sample in samples:
+        delta = sample - previous
+        previous = sample
+        zigzag = (delta << 1) ^ (delta >> 31)
+        zigzag &= 0xFFFFFFFF
+        while zigzag >= 0x80:
+            data.append((zigzag & 0x7F) | 0x80)
+            zigzag >>= 7
+        data.append(zigzag)
+    return bytes(data)
+
+
+class RegularSeriesValuesTest(unittest.TestCase):
+
+    def test_values(self):
+        self.assertEqual(regular_series_values({VALUES: SAMPLES, 1: 1000}), SAMPLES)
+
+    def test_typed_values(self):
+        data = encode_uint16_le(SAMPLES)
+        self.assertEqual(regular_series_values({TYPED_VALUES: data}), SAMPLES)
+        tagged = Tag(TYPED_ARRAY_UINT16_LE_TAG, data)
+        self.assertEqual(regular_series_values({TYPED_VALUES: tagged}), SAMPLES)
+
+    def test_typed_values_unsupported_tag(self):
+        with self.assertRaises(ValueError):
+            regular_series_values({TYPED_VALUES: Tag(70, b'\0\0\0\0')})
+
+    def test_delta_values(self):
+        data = encode_delta_varints(SAMPLES)
+        self.assertEqual(regular_series_values({DELTA_VALUES: data}), SAMPLES)
+
+    def test_negative_deltas(self):
+        # 1 -> zigzag 2, then -1 -> 1, -64 -> 127 (one byte), -65 -> 129 (two bytes)
+        data = encode_delta_varints([1, 0, -64, -129])
+        self.assertEqual(data, bytes([0x02, 0x01, 0x7F, 0x81, 0x01]))
+        self.assertEqual(decode_delta_varints(data), [1, 0, -64, -129])
+
+    def test_delta_values_of_firmware(self):
+        # The bytes cddlEncoderTest expects packDeltaVarints to produce
+        self.assertEqual(decode_delta_varints(bytes([0x00, 0xFE, 0x3F, 0x03, 0x02])),
+                         [0, 4095, 4093, 4094])
+        self.assertEqual(decode_delta_varints(bytes([0xFE, 0x3F, 0xFD, 0x3F])), [4095, 0])
+        self.assertEqual(decode_delta_varints(bytes([0x00, 0xFE, 0xFF, 0x07])), [0, 65535])
+        self.assertEqual(decode_delta_varints(bytes([0xFE, 0x3F])), [4095])
+
+    def test_delta_values_truncated(self):
+        data = encode_delta_varints(SAMPLES)
+        with self.assertRaises(ValueError):
+            decode_delta_varints(data[:-1] + bytes([data[-1] | 0x80]))
+
+    def test_without_values(self):
+        with self.assertRaises(ValueError):
+            regular_series_values({1: 1000})
+
+
+class RegularSeriesTest(unittest.TestCase):
+
+    def test_optional_items(self):
+        # One series with env-params, one without, one with a start-time as well
+        target = ['Load A', []]
+        first = {VALUES: [1, 2], 3: [10, -6]}
+        second = {TYPED_VALUES: encode_uint16_le([3, 4]), 2: [100000, 0]}
+        third = {DELTA_VALUES: encode_delta_varints([5, 6]), 3: [10, -6]}
+        log = [1, [0, -3], [target, ['vdda_mv', 3300], 0, 0, first,
+                            target, 0, 0, second,
+                            target, [], [0, -3], 0, 0, third]]
+        series = regular_series(log)
+        self.assertEqual(series, [first, second, third])
+        self.assertEqual([regular_series_values(s) for s in series], [[1, 2], [3, 4], [5, 6]])
+
+
+if __name__ == '__main__':
+    unittest.main()